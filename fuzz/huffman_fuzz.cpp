@@ -0,0 +1,13 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_verify.h"
+
+// libFuzzer entry point: every input goes to every in-memory decoder
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	exercise_decoders(data, size);
+	return 0;
+}
@@ -0,0 +1,603 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_ALPHABET_H
+#define HUFFMAN_ALPHABET_H
+
+#include "huffman_compression.h"
+
+#if defined(_MSC_VER)
+#include <stdlib.h> // _byteswap_uint64
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HUFFMAN_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define HUFFMAN_ALWAYS_INLINE inline
+#endif
+
+// x86-64 GCC and Clang builds carry a BMI2 copy of the bit packing loop
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define HUFFMAN_PACK_BMI2 1
+#endif
+
+// Canonical Huffman coding over an alphabet of N symbols of type Symbol. The
+// byte functions of huffman_compression.h are these templates with
+// N = NUM_CHAR; larger alphabets (up to 32768 symbols, see huffman_pairs.h)
+// use the same code lengths format, tables and bitstreams.
+
+template <size_t N>
+using SymbolFrequency = std::array<unsigned int, N>;
+
+template <size_t N>
+using SymbolLengths = std::array<uint8_t, N>;
+
+template <size_t N>
+using SymbolCodes = std::array<Codeword, N>;
+
+// Fixed-size scratch space: on the stack for byte alphabets, on the heap for
+// larger ones whose node arrays would not fit a small stack
+template <typename T, size_t Size, bool OnStack = (Size <= 2 * NUM_CHAR)>
+struct SymbolScratch
+{
+    std::array<T, Size> items;
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T *begin() { return items.data(); }
+};
+
+template <typename T, size_t Size>
+struct SymbolScratch<T, Size, false>
+{
+    std::vector<T> items = std::vector<T>(Size);
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T *begin() { return items.data(); }
+};
+
+// Function to count count symbols, every one of which must be below N
+template <typename Symbol, size_t N>
+void fill_symbol_frequency(const Symbol *symbols, size_t count, SymbolFrequency<N> &frequency)
+{
+    frequency.fill(0);
+    for (size_t i = 0; i < count; ++i)
+        frequency[symbols[i]]++;
+}
+
+// Function to build the Huffman code lengths on a fixed node array. Leaves
+// are sorted once; merged nodes are created in non-decreasing frequency
+// order, so the two cheapest nodes are always at the head of the leaf or the
+// merged queue.
+template <size_t N>
+void build_symbol_code_lengths(const SymbolFrequency<N> &frequency, SymbolLengths<N> &lengths)
+{
+    static_assert(N >= 2 && 2 * N - 1 <= 0xFFFF, "node indices are 16 bits");
+
+    SymbolScratch<uint16_t, N> leaves;
+    int leaf_count = 0;
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (frequency[i] > 0)
+            leaves[leaf_count++] = static_cast<uint16_t>(i);
+    }
+    std::sort(leaves.begin(), leaves.begin() + leaf_count, [&frequency](uint16_t a, uint16_t b)
+              { return frequency[a] < frequency[b] || (frequency[a] == frequency[b] && a < b); });
+
+    lengths.fill(0);
+    if (leaf_count == 1)
+        lengths[leaves[0]] = 1; // A lone symbol still needs a decodable code
+    if (leaf_count < 2)
+        return;
+
+    SymbolScratch<FlatNode, 2 * N - 1> nodes;
+    for (int k = 0; k < leaf_count; ++k)
+        nodes[k] = FlatNode{frequency[leaves[k]], 0};
+
+    int next_leaf = 0;
+    int next_merged = leaf_count;
+    int node_count = leaf_count;
+    auto pop_cheapest = [&]()
+    {
+        if (next_leaf < leaf_count && (next_merged >= node_count || nodes[next_leaf].frequency <= nodes[next_merged].frequency))
+            return next_leaf++;
+        return next_merged++;
+    };
+
+    while (node_count < 2 * leaf_count - 1)
+    {
+        int left = pop_cheapest();
+        int right = pop_cheapest();
+        nodes[node_count] = FlatNode{nodes[left].frequency + nodes[right].frequency, 0};
+        nodes[left].parent = nodes[right].parent = static_cast<uint16_t>(node_count);
+        ++node_count;
+    }
+
+    // Parents always follow their children, so one backward pass gives every depth
+    SymbolScratch<uint8_t, 2 * N - 1> depth;
+    depth[node_count - 1] = 0;
+    for (int k = node_count - 2; k >= 0; --k)
+        depth[k] = static_cast<uint8_t>(depth[nodes[k].parent] + 1);
+
+    for (int k = 0; k < leaf_count; ++k)
+        lengths[leaves[k]] = depth[k];
+}
+
+// Function to build optimal code lengths bounded by max_code_length
+// (package-merge). Level lists are built from the deepest level up; each one
+// merges the sorted leaves with the pairwise packages of the level below. The
+// 2n - 2 cheapest items of the top list decide the lengths: every leaf taken
+// at a level adds one bit to that symbol, every package takes two items of
+// the level below. Returns false when the symbols do not fit the limit.
+template <size_t N>
+bool build_symbol_length_limited_code_lengths(const SymbolFrequency<N> &frequency, int max_code_length, SymbolLengths<N> &lengths)
+{
+    std::vector<int> symbols;
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (frequency[i] > 0)
+            symbols.push_back(static_cast<int>(i));
+    }
+    std::stable_sort(symbols.begin(), symbols.end(), [&frequency](int a, int b)
+                     { return frequency[a] < frequency[b]; });
+
+    const size_t n = symbols.size();
+    if (max_code_length < 1 || max_code_length > 32 || n > (size_t(1) << max_code_length))
+        return false;
+
+    lengths.fill(0);
+    if (n == 1)
+        lengths[symbols[0]] = 1; // A lone symbol still needs a decodable code
+    if (n < 2)
+        return true;
+
+    // leaf_flags[level][k] tells whether item k of that level's list is a leaf
+    std::vector<std::vector<bool>> leaf_flags(max_code_length);
+    std::vector<uint64_t> current(n);
+    for (size_t k = 0; k < n; ++k)
+        current[k] = frequency[symbols[k]];
+    leaf_flags[max_code_length - 1].assign(n, true);
+
+    for (int level = max_code_length - 2; level >= 0; --level)
+    {
+        std::vector<uint64_t> merged;
+        std::vector<bool> &flags = leaf_flags[level];
+        merged.reserve(n + current.size() / 2);
+        flags.reserve(n + current.size() / 2);
+
+        size_t leaf = 0, package = 0, package_count = current.size() / 2;
+        while (leaf < n || package < package_count)
+        {
+            uint64_t package_weight = package < package_count ? current[2 * package] + current[2 * package + 1] : 0;
+            if (leaf < n && (package >= package_count || frequency[symbols[leaf]] <= package_weight))
+            {
+                merged.push_back(frequency[symbols[leaf++]]);
+                flags.push_back(true);
+            }
+            else
+            {
+                merged.push_back(package_weight);
+                flags.push_back(false);
+                ++package;
+            }
+        }
+        current.swap(merged);
+    }
+
+    // Walk back down, the selected items of every list are always a prefix
+    size_t selected = 2 * n - 2;
+    for (int level = 0; level < max_code_length && selected > 0; ++level)
+    {
+        size_t leaves = 0;
+        for (size_t k = 0; k < selected; ++k)
+        {
+            if (leaf_flags[level][k])
+                ++leaves;
+        }
+        for (size_t k = 0; k < leaves; ++k)
+            lengths[symbols[k]]++;
+        selected = 2 * (selected - leaves);
+    }
+    return true;
+}
+
+// Function to compute the code lengths under the optional limit (0 for none)
+template <size_t N>
+void build_symbol_code_lengths(const SymbolFrequency<N> &frequency, int max_code_length, SymbolLengths<N> &lengths)
+{
+    build_symbol_code_lengths(frequency, lengths);
+
+    // Rebuild the lengths under the limit when the tree is too deep
+    if (max_code_length > 0 && *std::max_element(lengths.begin(), lengths.end()) > max_code_length)
+    {
+        SymbolLengths<N> limited;
+        if (build_symbol_length_limited_code_lengths(frequency, max_code_length, limited))
+            lengths = limited;
+    }
+}
+
+// Function to assign canonical codes from the code lengths, returns false
+// when the lengths break the Kraft inequality
+template <size_t N>
+bool build_symbol_canonical_codes(const SymbolLengths<N> &lengths, SymbolCodes<N> &codes)
+{
+    constexpr int MAX_LENGTH = 64;
+    std::array<uint64_t, MAX_LENGTH + 1> length_count{};
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (lengths[i] > MAX_LENGTH)
+            return false;
+        length_count[lengths[i]]++;
+    }
+    length_count[0] = 0;
+
+    // Check the Kraft inequality, available codes are capped once they can no longer run out
+    uint64_t available = 1;
+    for (int length = 1; length <= MAX_LENGTH; ++length)
+    {
+        available = std::min<uint64_t>(available * 2, 2 * N);
+        if (length_count[length] > available)
+            return false;
+        available -= length_count[length];
+    }
+
+    // First code of every length
+    std::array<uint64_t, MAX_LENGTH + 1> next_code{};
+    uint64_t code = 0;
+    for (int length = 1; length <= MAX_LENGTH; ++length)
+    {
+        code = (code + length_count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        codes[i] = Codeword{lengths[i] != 0 ? next_code[lengths[i]]++ : 0, lengths[i]};
+    }
+    return true;
+}
+
+// Function to append the code lengths: a zero byte starts a run of up to
+// 256 unused symbols whose size minus one follows, any other byte is a
+// single length
+template <size_t N>
+void write_symbol_code_lengths(std::vector<unsigned char> &out, const SymbolLengths<N> &lengths)
+{
+    for (size_t i = 0; i < N;)
+    {
+        if (lengths[i] != 0)
+        {
+            out.push_back(lengths[i++]);
+            continue;
+        }
+
+        size_t run = 0;
+        while (i + run < N && run < NUM_CHAR && lengths[i + run] == 0)
+            ++run;
+        out.push_back(0);
+        out.push_back(static_cast<unsigned char>(run - 1));
+        i += run;
+    }
+}
+
+// Function to parse the code lengths written by write_symbol_code_lengths,
+// returns the bytes consumed or 0 when they are truncated or too many
+template <size_t N>
+size_t read_symbol_code_lengths(const unsigned char *data, size_t size, SymbolLengths<N> &lengths)
+{
+    size_t pos = 0;
+    for (size_t i = 0; i < N;)
+    {
+        if (pos >= size)
+            return 0;
+
+        unsigned char length = data[pos++];
+        if (length != 0)
+        {
+            lengths[i++] = length;
+            continue;
+        }
+
+        if (pos >= size)
+            return 0;
+        size_t run = data[pos++] + size_t(1);
+        if (i + run > N)
+            return 0;
+        std::fill(lengths.begin() + i, lengths.begin() + i + run, 0);
+        i += run;
+    }
+    return pos;
+}
+
+// Function to build the lookup tables of the codes, returns false when a
+// code is longer than MAX_TABLE_CODE_LENGTH
+template <size_t N>
+bool build_symbol_decode_table(const SymbolCodes<N> &codes, DecodeTable &table)
+{
+    static_assert(N <= 0x10000, "paired entries hold 16-bit symbols");
+
+    const uint32_t primary_size = 1u << DECODE_TABLE_BITS;
+    std::array<uint8_t, size_t(1) << DECODE_TABLE_BITS> sub_bits{};
+
+    table.entries.assign(primary_size, DecodeEntry{0, 0, 0, 0});
+    table.max_length = 0;
+
+    // Size the subtables from the longest code behind each primary prefix
+    for (size_t i = 0; i < N; ++i)
+    {
+        int length = codes[i].length;
+        if (length > MAX_TABLE_CODE_LENGTH)
+            return false;
+
+        table.max_length = std::max(table.max_length, length);
+        if (length > DECODE_TABLE_BITS)
+        {
+            uint32_t prefix = static_cast<uint32_t>(codes[i].bits >> (length - DECODE_TABLE_BITS));
+            sub_bits[prefix] = static_cast<uint8_t>(std::max<int>(sub_bits[prefix], length - DECODE_TABLE_BITS));
+        }
+    }
+
+    // Allocate one subtable per long prefix, directly after the primary table
+    for (uint32_t prefix = 0; prefix < primary_size; ++prefix)
+    {
+        if (sub_bits[prefix] > 0)
+        {
+            DecodeEntry &link = table.entries[prefix];
+            link.value = static_cast<uint32_t>(table.entries.size());
+            link.sub_bits = static_cast<uint8_t>(sub_bits[prefix]);
+            table.entries.resize(table.entries.size() + (size_t(1) << sub_bits[prefix]), DecodeEntry{0, 0, 0, 0});
+        }
+    }
+
+    // Replicate every code over all the slots that start with it
+    for (size_t i = 0; i < N; ++i)
+    {
+        int length = codes[i].length;
+        if (length == 0)
+            continue;
+
+        uint32_t code = static_cast<uint32_t>(codes[i].bits);
+        DecodeEntry entry{static_cast<uint32_t>(i), static_cast<uint8_t>(length), 0, 0};
+        if (length <= DECODE_TABLE_BITS)
+        {
+            uint32_t first = code << (DECODE_TABLE_BITS - length);
+            uint32_t count = 1u << (DECODE_TABLE_BITS - length);
+            for (uint32_t j = 0; j < count; ++j)
+                table.entries[first + j] = entry;
+        }
+        else
+        {
+            int extra = length - DECODE_TABLE_BITS;
+            const DecodeEntry &link = table.entries[code >> extra];
+            uint32_t suffix = code & ((1u << extra) - 1);
+            uint32_t first = link.value + (suffix << (link.sub_bits - extra));
+            uint32_t count = 1u << (link.sub_bits - extra);
+            for (uint32_t j = 0; j < count; ++j)
+                table.entries[first + j] = entry;
+        }
+    }
+
+    // Pair short codes so a single primary hit can emit two symbols
+    for (uint32_t index = 0; index < primary_size; ++index)
+    {
+        DecodeEntry &entry = table.entries[index];
+        if (entry.length == 0 || entry.sub_bits != 0)
+            continue;
+
+        const DecodeEntry &next = table.entries[(index << entry.length) & (primary_size - 1)];
+        if (next.length != 0 && next.sub_bits == 0 && entry.length + next.length <= DECODE_TABLE_BITS)
+        {
+            entry.value |= (next.value & 0xFFFF) << 16;
+            entry.pair_length = static_cast<uint8_t>(entry.length + next.length);
+        }
+    }
+
+    return true;
+}
+
+// Function to store a 64-bit value MSB first at an unaligned address, as
+// one byte-swapped word store on little-endian GCC, Clang and MSVC builds
+inline void store_be64(unsigned char *out, uint64_t value)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap64(value);
+    std::memcpy(out, &value, sizeof(value));
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64))
+    value = _byteswap_uint64(value);
+    std::memcpy(out, &value, sizeof(value));
+#else
+    for (int i = 0; i < 8; ++i)
+        out[i] = static_cast<unsigned char>(value >> (56 - 8 * i));
+#endif
+}
+
+// Codes of an alphabet laid out for pack_symbol_words: every code
+// left-aligned in a 64-bit word, next to its length
+template <size_t N>
+struct PackedCodes
+{
+    SymbolScratch<uint64_t, N> words;
+    SymbolScratch<uint8_t, N> lengths;
+};
+
+// Function to pack count symbols MSB first into out, after the pending
+// (0 to 7) bits already at the top of out[0]; out needs room for the packed
+// bytes plus 8. Every step ORs K codes into the 64-bit accumulator and
+// stores it as a whole word, then advances out by the complete bytes; the
+// store has no branch on how many bits are ready. Less than 8 bits stay
+// behind after a store, so K codes must fit the other 56. Returns the
+// number of bits from the start of out[0].
+template <int K, typename Symbol, size_t N>
+HUFFMAN_ALWAYS_INLINE uint64_t pack_symbol_words(const Symbol *symbols, size_t count, const PackedCodes<N> &codes, unsigned char *out, int pending)
+{
+    static_assert(K >= 1 && K <= 4, "1 to 4 codes per store");
+    unsigned char *const start = out;
+    uint64_t accumulator = pending > 0 ? static_cast<uint64_t>(out[0]) << 56 : 0; // Pending bits, left-aligned
+    int filled = pending;                                                          // Pending bits in the accumulator
+    size_t i = 0;
+    auto put = [&](size_t k)
+    {
+        accumulator |= codes.words[symbols[k]] >> filled;
+        filled += codes.lengths[symbols[k]];
+    };
+    auto store = [&]()
+    {
+        store_be64(out, accumulator);
+        const int bytes = filled >> 3;
+        out += bytes;
+        accumulator <<= 8 * bytes;
+        filled &= 7;
+    };
+
+    for (; i + K <= count; i += K)
+    {
+        put(i);
+        if (K > 1)
+            put(i + 1);
+        if (K > 2)
+            put(i + 2);
+        if (K > 3)
+            put(i + 3);
+        store();
+    }
+    for (; i < count; ++i)
+    {
+        put(i);
+        store();
+    }
+
+    // The last partial byte, already zero padded
+    store_be64(out, accumulator);
+    return 8 * static_cast<uint64_t>(out - start) + static_cast<uint64_t>(filled);
+}
+
+#if defined(HUFFMAN_PACK_BMI2)
+// The same loop built for BMI2, whose shifts by a register amount are a
+// single instruction instead of three
+template <int K, typename Symbol, size_t N>
+__attribute__((target("bmi2"))) uint64_t pack_symbol_words_bmi2(const Symbol *symbols, size_t count, const PackedCodes<N> &codes, unsigned char *out,
+                                                                  int pending)
+{
+    return pack_symbol_words<K>(symbols, count, codes, out, pending);
+}
+#endif
+
+// Function to pack symbols with the BMI2 loop when the CPU has it
+template <int K, typename Symbol, size_t N>
+uint64_t pack_symbols(const Symbol *symbols, size_t count, const PackedCodes<N> &codes, unsigned char *out, int pending)
+{
+#if defined(HUFFMAN_PACK_BMI2)
+    static const bool has_bmi2 = __builtin_cpu_supports("bmi2");
+    if (has_bmi2)
+        return pack_symbol_words_bmi2<K>(symbols, count, codes, out, pending);
+#endif
+    return pack_symbol_words<K>(symbols, count, codes, out, pending);
+}
+
+// Symbols packed per call of pack_symbols, the output grows by the worst
+// case of one chunk at a time
+constexpr size_t PACK_CHUNK_SYMBOLS = 16384;
+
+// Function to encode count symbols straight into packed bits, returns the
+// number of bits written. Codes of up to MAX_TABLE_CODE_LENGTH bits are
+// packed word by word into the resized output, 4 symbols per step when they
+// fit 14 bits, 3 up to 18 and 2 up to 24; longer codes use BitWriter.
+template <typename Symbol, size_t N>
+uint64_t encode_symbols(const Symbol *symbols, size_t count, const SymbolCodes<N> &codes, std::vector<unsigned char> &packed)
+{
+    int longest = 0;
+    for (const Codeword &code : codes)
+        longest = std::max<int>(longest, code.length);
+
+    if (longest > MAX_TABLE_CODE_LENGTH)
+    {
+        BitWriter writer(packed);
+        for (size_t i = 0; i < count; ++i)
+        {
+            writer.put(codes[symbols[i]].bits, codes[symbols[i]].length);
+        }
+        writer.flush();
+        return writer.bit_count();
+    }
+
+    PackedCodes<N> packed_codes;
+    for (size_t s = 0; s < N; ++s)
+    {
+        packed_codes.words[s] = codes[s].length == 0 ? 0 : codes[s].bits << (64 - codes[s].length);
+        packed_codes.lengths[s] = codes[s].length;
+    }
+
+    // Grow the output by the longest code for every symbol of a chunk plus
+    // the word stores' overhang, so skewed data does not clear its worst
+    // case all at once; trim it at the end
+    const size_t start = packed.size();
+    size_t next = start; // Byte holding the pending bits
+    int pending = 0;
+    for (size_t i = 0; i < count; i += PACK_CHUNK_SYMBOLS)
+    {
+        const size_t chunk = std::min(count - i, PACK_CHUNK_SYMBOLS);
+        packed.resize(std::max(packed.size(), next + (chunk * static_cast<size_t>(longest) + 7) / 8 + 9));
+        unsigned char *out = packed.data() + next;
+        uint64_t bits = longest <= 14   ? pack_symbols<4>(symbols + i, chunk, packed_codes, out, pending)
+                        : longest <= 18 ? pack_symbols<3>(symbols + i, chunk, packed_codes, out, pending)
+                                        : pack_symbols<2>(symbols + i, chunk, packed_codes, out, pending);
+        next += static_cast<size_t>(bits / 8);
+        pending = static_cast<int>(bits % 8);
+    }
+    packed.resize(next + (pending > 0));
+    return 8 * static_cast<uint64_t>(next - start) + static_cast<uint64_t>(pending);
+}
+
+// Function to decode exactly count symbols using the lookup tables, starting
+// skip_bits into the first byte; returns the number decoded (less than count
+// when the data is truncated or malformed)
+template <typename Symbol>
+size_t decode_symbol_stream(const unsigned char *data, size_t size, const DecodeTable &table, Symbol *out, size_t count, int skip_bits = 0)
+{
+    BitReader reader(data, size, skip_bits);
+    size_t produced = 0;
+
+    // Fast loop: the window always holds a whole code, and both symbol slots
+    // of an entry are written so a pair costs no extra branch
+    while (produced + 2 <= count && reader.has_word())
+    {
+        reader.refill();
+
+        const DecodeEntry &entry = table.lookup(reader.bits());
+        if (entry.length == 0)
+            return produced; // Not a valid code
+
+        out[produced] = static_cast<Symbol>(entry.value & 0xFFFF);
+        out[produced + 1] = static_cast<Symbol>(entry.value >> 16);
+        bool pair = entry.pair_length != 0;
+        reader.consume(pair ? entry.pair_length : entry.length);
+        produced += pair ? 2 : 1;
+    }
+
+    // Checked loop for the end of the data and the last symbol
+    while (produced < count)
+    {
+        reader.refill();
+
+        const DecodeEntry &entry = table.lookup(reader.bits());
+        if (entry.length == 0 || entry.length > reader.available())
+            break; // Not a valid code, or the data is truncated
+
+        if (entry.pair_length != 0 && entry.pair_length <= reader.available() && produced + 2 <= count)
+        {
+            out[produced++] = static_cast<Symbol>(entry.value & 0xFFFF);
+            out[produced++] = static_cast<Symbol>(entry.value >> 16);
+            reader.consume(entry.pair_length);
+        }
+        else
+        {
+            out[produced++] = static_cast<Symbol>(entry.value & 0xFFFF);
+            reader.consume(entry.length);
+        }
+    }
+
+    return produced;
+}
+
+#endif // HUFFMAN_ALPHABET_H
@@ -0,0 +1,354 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_batch.h"
+#include "huffman_parallel.h"
+
+#include <atomic>
+#include <climits>
+#include <memory>
+
+// Consecutive records coded by one task, and what it made of them
+struct BatchGroup
+{
+	size_t begin = 0; // First record
+	size_t end = 0;	  // One past the last record
+	std::array<uint64_t, NUM_CHAR> totals{};
+	std::vector<unsigned char> packed;	// Packed records of the group, back to back
+	std::vector<uint64_t> offsets;		// Offset of every record in packed
+	std::vector<uint32_t> checksums;
+};
+
+// Function to count the bytes of the records of a group
+static void count_group(const std::vector<BatchRecord> &records, BatchGroup &group)
+{
+	// Count in chunks the 32-bit frequency table cannot overflow on
+	constexpr size_t CHUNK_SIZE = size_t(1) << 30;
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	size_t counted = 0;
+	for (size_t k = group.begin; k < group.end; ++k)
+	{
+		const unsigned char *data = records[k].data;
+		size_t size = records[k].size;
+		while (size > 0)
+		{
+			size_t chunk = std::min(size, CHUNK_SIZE - counted);
+			fill_frequency(data, chunk, frequency);
+			data += chunk;
+			size -= chunk;
+			counted += chunk;
+			if (counted == CHUNK_SIZE)
+			{
+				for (int i = 0; i < NUM_CHAR; ++i)
+					group.totals[i] += frequency[i];
+				init_frequency(frequency);
+				counted = 0;
+			}
+		}
+	}
+	for (int i = 0; i < NUM_CHAR; ++i)
+		group.totals[i] += frequency[i];
+}
+
+// Function to pack the records of a group one after the other
+static void encode_group(const std::vector<BatchRecord> &records, const CodeTable &codes, BatchGroup &group)
+{
+	group.offsets.resize(group.end - group.begin);
+	group.checksums.resize(group.end - group.begin);
+	for (size_t k = group.begin; k < group.end; ++k)
+	{
+		group.offsets[k - group.begin] = group.packed.size();
+		group.checksums[k - group.begin] = crc32c(records[k].data, records[k].size);
+		encode_data(records[k].data, records[k].size, codes, group.packed);
+	}
+}
+
+// Function to run task over every group, on workers when pool is given
+static void run_groups(ThreadPool *pool, std::vector<BatchGroup> &groups, const std::function<void(BatchGroup &)> &task)
+{
+	if (pool == nullptr)
+	{
+		for (BatchGroup &group : groups)
+			task(group);
+		return;
+	}
+	for (BatchGroup &group : groups)
+		pool->submit([&task, &group]
+					 { task(group); });
+	pool->wait();
+}
+
+// Function to compress the records into one batch
+bool compress_batch(const std::vector<BatchRecord> &records, std::vector<unsigned char> &out, const CompressionOptions &options, const HuffmanDictionary *dictionary)
+{
+	if (records.size() > UINT32_MAX)
+		return false;
+
+	uint64_t total = 0;
+	for (const BatchRecord &record : records)
+	{
+		if (record.size > UINT32_MAX)
+			return false;
+		total += record.size;
+	}
+
+	// Small batches are not worth starting workers for
+	unsigned threads = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	if (total < BATCH_PARALLEL_MIN_SIZE || records.size() < 2)
+		threads = 1;
+	std::unique_ptr<ThreadPool> pool;
+	if (threads > 1)
+		pool.reset(new ThreadPool(threads));
+
+	// A few groups per worker, of about the same number of bytes, even out uneven records
+	size_t group_count = std::min<size_t>(std::max<size_t>(records.size(), 1), size_t(threads) * 4);
+	std::vector<BatchGroup> groups(group_count);
+	size_t next = 0;
+	uint64_t assigned = 0;
+	for (size_t g = 0; g < group_count; ++g)
+	{
+		uint64_t target = total * (g + 1) / group_count;
+		groups[g].begin = next;
+		while (next < records.size() && (assigned < target || g + 1 == group_count))
+			assigned += records[next++].size;
+		groups[g].end = next;
+	}
+
+	CompressionStats *stats = options.stats;
+	CodeLengths lengths{};
+	CodeTable codes{};
+	const CodeTable *record_codes = &codes;
+	if (dictionary != nullptr)
+	{
+		record_codes = &dictionary->codes;
+		lengths = dictionary->lengths;
+	}
+	else
+	{
+		StageTimer histogram_timer(stat_field(stats, &CompressionStats::histogram_ns));
+		run_groups(pool.get(), groups, [&records](BatchGroup &group)
+				   { count_group(records, group); });
+		std::array<uint64_t, NUM_CHAR> totals{};
+		for (const BatchGroup &group : groups)
+			for (int i = 0; i < NUM_CHAR; ++i)
+				totals[i] += group.totals[i];
+
+		// Scale large batches down to the 32-bit frequency table, keeping every byte seen
+		uint64_t largest = *std::max_element(totals.begin(), totals.end());
+		int shift = 0;
+		while ((largest >> shift) >= UINT_MAX / 2)
+			++shift;
+		std::array<unsigned int, NUM_CHAR> frequency;
+		for (int i = 0; i < NUM_CHAR; ++i)
+			frequency[i] = static_cast<unsigned int>(totals[i] >> shift) + (shift != 0 && totals[i] != 0 ? 1 : 0);
+		histogram_timer.stop();
+
+		// The decoder tables read codes of up to MAX_TABLE_CODE_LENGTH bits
+		StageTimer tree_timer(stat_field(stats, &CompressionStats::tree_ns));
+		int max_code_length = options.max_code_length > 0 ? std::min(options.max_code_length, MAX_TABLE_CODE_LENGTH) : MAX_TABLE_CODE_LENGTH;
+		build_code_lengths(frequency, max_code_length, lengths);
+		build_canonical_codes(lengths, codes);
+	}
+
+	StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+	run_groups(pool.get(), groups, [&records, record_codes](BatchGroup &group)
+			   { encode_group(records, *record_codes, group); });
+	code_timer.stop();
+
+	size_t start = out.size();
+	write_le32(out, BATCH_MAGIC);
+	out.push_back(BATCH_VERSION);
+	out.push_back(dictionary != nullptr ? BATCH_FLAG_DICTIONARY : 0);
+	out.push_back(0);
+	out.push_back(0);
+	write_le32(out, static_cast<uint32_t>(records.size()));
+	if (dictionary != nullptr)
+		write_le32(out, dictionary->id);
+	else
+		write_code_lengths(out, lengths);
+
+	uint64_t base = out.size() - start + records.size() * BATCH_ENTRY_SIZE;
+	for (const BatchGroup &group : groups)
+	{
+		for (size_t k = group.begin; k < group.end; ++k)
+		{
+			write_le64(out, base + group.offsets[k - group.begin]);
+			write_le32(out, static_cast<uint32_t>(records[k].size));
+			write_le32(out, group.checksums[k - group.begin]);
+		}
+		base += group.packed.size();
+	}
+	for (const BatchGroup &group : groups)
+		out.insert(out.end(), group.packed.begin(), group.packed.end());
+
+	if (stats != nullptr)
+	{
+		stats->bytes_in += total;
+		stats->bytes_out += out.size() - start;
+		stats->symbols += total;
+		stats->distinct_symbols = std::max<int>(stats->distinct_symbols, static_cast<int>(std::count_if(lengths.begin(), lengths.end(), [](uint8_t length)
+																									   { return length != 0; })));
+		stats->max_code_length = std::max<int>(stats->max_code_length, *std::max_element(lengths.begin(), lengths.end()));
+	}
+	return true;
+}
+
+BatchDecoder::BatchDecoder() : data(nullptr), record_table(nullptr)
+{
+}
+
+// Function to register a shared dictionary
+void BatchDecoder::add_dictionary(const HuffmanDictionary *dictionary)
+{
+	for (const HuffmanDictionary *&known : dictionaries)
+	{
+		if (known->id == dictionary->id)
+		{
+			known = dictionary;
+			return;
+		}
+	}
+	dictionaries.push_back(dictionary);
+}
+
+// Function to parse the batch header, code and index
+bool BatchDecoder::open(const unsigned char *data, size_t size)
+{
+	this->data = nullptr;
+	index.clear();
+	record_table = nullptr;
+
+	if (size < BATCH_HEADER_SIZE || read_le32(data) != BATCH_MAGIC || data[4] < 1 || data[4] > BATCH_VERSION || (data[5] & ~BATCH_FLAG_DICTIONARY) != 0)
+		return false;
+
+	uint32_t count = read_le32(data + 8);
+	size_t position = BATCH_HEADER_SIZE;
+	bool have_code = true;
+	if (data[5] & BATCH_FLAG_DICTIONARY)
+	{
+		if (size - position < 4)
+			return false;
+		uint32_t id = read_le32(data + position);
+		position += 4;
+		for (const HuffmanDictionary *dictionary : dictionaries)
+			if (dictionary->id == id)
+				record_table = &dictionary->table;
+		if (record_table == nullptr)
+			return false;
+	}
+	else
+	{
+		CodeLengths lengths;
+		CodeTable codes;
+		size_t consumed = read_code_lengths(data + position, size - position, lengths);
+		if (consumed == 0)
+			return false;
+		position += consumed;
+
+		// A batch of empty records has no code
+		have_code = std::find_if(lengths.begin(), lengths.end(), [](uint8_t length)
+								 { return length != 0; }) != lengths.end();
+		if (have_code && (!build_canonical_codes(lengths, codes) || !build_decode_table(codes, table)))
+			return false;
+		record_table = &table;
+	}
+
+	if ((size - position) / BATCH_ENTRY_SIZE < count)
+		return false;
+
+	// Records follow the index in order, so each ends where the next starts
+	uint64_t records_start = position + uint64_t(count) * BATCH_ENTRY_SIZE;
+	index.resize(count);
+	for (uint32_t k = 0; k < count; ++k, position += BATCH_ENTRY_SIZE)
+	{
+		Entry &entry = index[k];
+		entry.offset = read_le64(data + position);
+		entry.raw_size = read_le32(data + position + 8);
+		entry.checksum = read_le32(data + position + 12);
+		if (entry.offset < (k == 0 ? records_start : index[k - 1].offset) || entry.offset > size || (entry.raw_size != 0 && !have_code))
+		{
+			index.clear();
+			return false;
+		}
+		if (k != 0)
+			index[k - 1].end = entry.offset;
+	}
+	if (count != 0)
+		index.back().end = size;
+
+	// Every symbol takes at least one bit of the record's bytes
+	for (const Entry &entry : index)
+	{
+		if (entry.raw_size > 8 * (entry.end - entry.offset))
+		{
+			index.clear();
+			return false;
+		}
+	}
+
+	this->data = data;
+	return true;
+}
+
+// Function to decode one record by index
+bool BatchDecoder::decode(size_t k, unsigned char *out, size_t capacity, size_t &out_size) const
+{
+	out_size = 0;
+	if (data == nullptr || k >= index.size() || index[k].raw_size > capacity)
+		return false;
+
+	const Entry &entry = index[k];
+	if (entry.raw_size != 0 &&
+		decode_symbols(data + entry.offset, static_cast<size_t>(entry.end - entry.offset), *record_table, out, entry.raw_size) != entry.raw_size)
+		return false;
+	if (crc32c(out, entry.raw_size) != entry.checksum)
+		return false;
+
+	out_size = entry.raw_size;
+	return true;
+}
+
+// Function to decode every record concurrently
+bool BatchDecoder::decode_all(std::vector<std::vector<unsigned char>> &records, unsigned threads) const
+{
+	if (data == nullptr)
+		return false;
+
+	records.resize(index.size());
+	uint64_t total = 0;
+	for (size_t k = 0; k < index.size(); ++k)
+	{
+		records[k].resize(index[k].raw_size);
+		total += index[k].raw_size;
+	}
+
+	std::atomic<bool> ok(true);
+	auto decode_group = [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end && ok; ++k)
+		{
+			size_t out_size;
+			if (!decode(k, records[k].data(), records[k].size(), out_size))
+				ok = false;
+		}
+	};
+
+	// Small batches are not worth starting workers for
+	threads = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+	if (total < BATCH_PARALLEL_MIN_SIZE || index.size() < 2 || threads == 1)
+	{
+		decode_group(0, index.size());
+		return ok;
+	}
+
+	ThreadPool pool(threads);
+	size_t group_count = std::min<size_t>(index.size(), size_t(threads) * 4);
+	for (size_t g = 0; g < group_count; ++g)
+		pool.submit([&, g]
+					{ decode_group(index.size() * g / group_count, index.size() * (g + 1) / group_count); });
+	pool.wait();
+	return ok;
+}
@@ -0,0 +1,111 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_BATCH_H
+#define HUFFMAN_BATCH_H
+
+#include "huffman_dictionary.h"
+
+// Marks a batch of records ("AHUB")
+constexpr uint32_t BATCH_MAGIC = 0x42554841;
+
+// Batch version written by this library, readers reject newer ones
+constexpr uint8_t BATCH_VERSION = 1;
+
+// Size of the fixed part of a batch, and of one index entry
+constexpr size_t BATCH_HEADER_SIZE = 12;
+constexpr size_t BATCH_ENTRY_SIZE = 16;
+
+// Batch flags
+constexpr uint8_t BATCH_FLAG_DICTIONARY = 0x01; // uint32 id of a shared dictionary instead of code lengths
+
+// Batches smaller than this are coded on the calling thread
+constexpr size_t BATCH_PARALLEL_MIN_SIZE = size_t(256) << 10;
+
+// Many small records coded with one shared code, little-endian:
+//   uint32 BATCH_MAGIC
+//   uint8 version
+//   uint8 flags
+//   uint16 reserved     0
+//   uint32 record_count
+//   code lengths        run-length coded (see write_code_lengths), or the
+//                       uint32 id of a shared dictionary
+//   record_count index entries:
+//     uint64 offset     of the record's packed bits from the batch start
+//     uint32 raw_size
+//     uint32 checksum   CRC32C of the record
+//   packed records, each padded to a whole byte and ending where the next
+//   one starts (the last at the end of the batch)
+//
+// The code is built over all records at once, so each record costs its
+// packed bits and 16 bytes of index instead of a table and a header.
+
+// One input record, a span the caller owns
+struct BatchRecord
+{
+    const unsigned char *data;
+    size_t size;
+};
+
+// Function to compress the records into one batch appended to out. The code
+// is either built from the byte frequencies of all records (with codes no
+// longer than options.max_code_length, at most MAX_TABLE_CODE_LENGTH) or
+// taken from dictionary when given. Batches of BATCH_PARALLEL_MIN_SIZE bytes
+// or more are counted and coded on options.threads workers, in groups of
+// consecutive records. Counts and stage times are added to options.stats.
+// Returns false when there are more than 2^32 - 1 records or a record of
+// 4 GiB or more.
+bool compress_batch(const std::vector<BatchRecord> &records, std::vector<unsigned char> &out, const CompressionOptions &options = CompressionOptions(),
+                    const HuffmanDictionary *dictionary = nullptr);
+
+// Reads the records of a batch by index. open() checks the layout and builds
+// the decode table once; decode() is const, so any number of threads can
+// decode records of one open batch at the same time.
+class BatchDecoder
+{
+public:
+    BatchDecoder();
+
+    // Function to make a prepared dictionary available to batches naming its
+    // id; it must outlive its use and replaces an earlier one with the same id
+    void add_dictionary(const HuffmanDictionary *dictionary);
+
+    // Function to parse the batch at data, which must stay valid while
+    // records are decoded. Returns false when it is malformed (a record
+    // claiming more bytes than it has bits included) or names a dictionary
+    // that was not added.
+    bool open(const unsigned char *data, size_t size);
+
+    size_t record_count() const { return index.size(); }
+
+    // Decoded size of record k
+    size_t record_size(size_t k) const { return index[k].raw_size; }
+
+    // Function to decode record k into out, returns false when it is
+    // malformed, fails its checksum or does not fit in capacity bytes;
+    // out_size is set to the decoded size
+    bool decode(size_t k, unsigned char *out, size_t capacity, size_t &out_size) const;
+
+    // Function to decode every record into records on threads workers (0
+    // for one per hardware thread), returns false when one is malformed
+    bool decode_all(std::vector<std::vector<unsigned char>> &records, unsigned threads = 0) const;
+
+private:
+    struct Entry
+    {
+        uint64_t offset;
+        uint64_t end; // Offset of the next record, or the batch size
+        uint32_t raw_size;
+        uint32_t checksum;
+    };
+
+    const unsigned char *data;
+    std::vector<Entry> index;
+    DecodeTable table;                 // Table of code lengths stored in the batch
+    const DecodeTable *record_table;   // table, or the dictionary's
+    std::vector<const HuffmanDictionary *> dictionaries;
+};
+
+#endif // HUFFMAN_BATCH_H
@@ -0,0 +1,433 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_batch.h"
+#include "huffman_compression.h"
+#include "huffman_corpus.h"
+#include "huffman_format.h"
+#include "huffman_stream.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+
+// A benchmark input: generated, or a file named by HUFFMAN_BENCH_FILE
+struct Corpus
+{
+	std::string name;
+	std::string data;
+};
+
+// Function to build the corpora once for all benchmarks
+static const std::vector<Corpus> &corpora()
+{
+	static const std::vector<Corpus> all = []()
+	{
+		std::vector<Corpus> list = {{"text", make_text(CORPUS_SIZE)},
+									{"binary", make_binary(CORPUS_SIZE)},
+									{"low_entropy", make_low_entropy(CORPUS_SIZE)},
+									{"random", make_random(CORPUS_SIZE)},
+									{"skewed", make_skewed(CORPUS_SIZE)}};
+		if (const char *path = std::getenv("HUFFMAN_BENCH_FILE"))
+		{
+			std::ifstream file(path, std::ios::binary);
+			std::ostringstream contents;
+			contents << file.rdbuf();
+			if (file)
+				list.push_back({"file", contents.str()});
+		}
+		return list;
+	}();
+	return all;
+}
+
+static const Corpus &corpus(const benchmark::State &state)
+{
+	return corpora()[static_cast<size_t>(state.range(0))];
+}
+
+static const unsigned char *bytes(const std::string &data)
+{
+	return reinterpret_cast<const unsigned char *>(data.data());
+}
+
+// Path of a scratch file in the working directory
+static std::string scratch_path(const std::string &name)
+{
+	return "huffman_bench_" + name + ".tmp";
+}
+
+// Function to report throughput over the input and the compression ratio
+static void report(benchmark::State &state, const Corpus &input, size_t compressed_size)
+{
+	state.SetLabel(input.name);
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(input.data.size()));
+	if (compressed_size > 0)
+		state.counters["ratio"] = static_cast<double>(input.data.size()) / compressed_size;
+}
+
+static void BM_fill_frequency(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	for (auto _ : state)
+	{
+		init_frequency(frequency);
+		fill_frequency(bytes(input.data), input.data.size(), frequency);
+		benchmark::DoNotOptimize(frequency.data());
+	}
+	report(state, input, 0);
+}
+
+static void BM_sample_frequency(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	for (auto _ : state)
+	{
+		init_frequency(frequency);
+		sample_frequency(bytes(input.data), input.data.size(), DEFAULT_SAMPLE_STEP, frequency);
+		benchmark::DoNotOptimize(frequency.data());
+	}
+	report(state, input, 0);
+}
+
+static void BM_build_huffman_tree(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	for (auto _ : state)
+	{
+		std::shared_ptr<Node> root = build_huffman_tree(frequency);
+		benchmark::DoNotOptimize(root.get());
+	}
+	state.SetLabel(input.name);
+}
+
+static void BM_build_code_lengths(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	const int max_code_length = static_cast<int>(state.range(1));
+	CodeLengths lengths;
+	for (auto _ : state)
+	{
+		build_code_lengths(frequency, max_code_length, lengths);
+		benchmark::DoNotOptimize(lengths.data());
+	}
+
+	// Ratio of the coded corpus under this limit, and its size against the unlimited code
+	CodeLengths unlimited;
+	build_code_lengths(frequency, 0, unlimited);
+	uint64_t bits = 0, unlimited_bits = 0;
+	for (int i = 0; i < NUM_CHAR; ++i)
+	{
+		bits += static_cast<uint64_t>(frequency[i]) * lengths[i];
+		unlimited_bits += static_cast<uint64_t>(frequency[i]) * unlimited[i];
+	}
+	std::vector<unsigned char> table;
+	write_code_lengths(table, lengths);
+	state.SetLabel(input.name + (max_code_length == 0 ? " unlimited" : " max " + std::to_string(max_code_length)));
+	state.counters["ratio"] = static_cast<double>(input.data.size()) / ((bits + 7) / 8 + table.size());
+	state.counters["vs_unlimited"] = unlimited_bits != 0 ? static_cast<double>(bits) / unlimited_bits : 1.0;
+}
+
+static void BM_generate_dictionary(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	std::shared_ptr<Node> root = build_huffman_tree(frequency);
+	for (auto _ : state)
+	{
+		std::array<std::string, NUM_CHAR> dict;
+		generate_dictionary(root, "", dict);
+		benchmark::DoNotOptimize(dict.data());
+	}
+	state.SetLabel(input.name);
+}
+
+static void BM_encode_text(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	std::array<std::string, NUM_CHAR> dict;
+	generate_dictionary(build_huffman_tree(frequency), "", dict);
+	size_t encoded_bits = 0;
+	for (auto _ : state)
+	{
+		std::string encoded = encode_text(input.data, dict);
+		encoded_bits = encoded.size();
+		benchmark::DoNotOptimize(encoded.data());
+	}
+	report(state, input, (encoded_bits + 7) / 8);
+}
+
+static void BM_encode_data(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	CodeLengths lengths;
+	build_code_lengths(frequency, DEFAULT_MAX_CODE_LENGTH, lengths);
+	CodeTable codes{};
+	build_canonical_codes(lengths, codes);
+	std::vector<unsigned char> packed;
+	for (auto _ : state)
+	{
+		packed.clear();
+		encode_data(bytes(input.data), input.data.size(), codes, packed);
+		benchmark::DoNotOptimize(packed.data());
+	}
+	std::vector<unsigned char> table;
+	write_code_lengths(table, lengths);
+	report(state, input, packed.size() + table.size());
+}
+
+static void BM_write_compressed_file(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	const std::string path = scratch_path(input.name);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	CodeLengths lengths;
+	build_code_lengths(frequency, DEFAULT_MAX_CODE_LENGTH, lengths);
+	CodeTable codes{};
+	build_canonical_codes(lengths, codes);
+	std::vector<unsigned char> packed;
+	uint64_t bit_count = encode_data(bytes(input.data), input.data.size(), codes, packed);
+
+	FileHeader header;
+	header.flags = FILE_FLAG_CANONICAL;
+	header.original_size = input.data.size();
+	header.checksum = crc32c(bytes(input.data), input.data.size());
+	header.final_bits = static_cast<uint8_t>(bit_count == 0 ? 0 : (bit_count - 1) % 8 + 1);
+	for (auto _ : state)
+	{
+		if (write_compressed_file(path, header, codes, packed) != HuffmanStatus::OK)
+		{
+			state.SkipWithError("write_compressed_file failed");
+			break;
+		}
+	}
+
+	std::ifstream written(path, std::ios::binary | std::ios::ate);
+	report(state, input, static_cast<size_t>(written.tellg()));
+	written.close();
+	std::remove(path.c_str());
+}
+
+static void BM_decode_data(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	const std::string path = scratch_path(input.name);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	std::shared_ptr<Node> root = build_huffman_tree(frequency);
+	CodeTable codes{};
+	generate_codes(root, 0, 0, codes);
+	std::vector<unsigned char> packed;
+	uint64_t bit_count = encode_data(bytes(input.data), input.data.size(), codes, packed);
+	{
+		std::ofstream file(path, std::ios::binary);
+		file.write(reinterpret_cast<const char *>(packed.data()), static_cast<std::streamsize>(packed.size()));
+	}
+
+	for (auto _ : state)
+	{
+		std::ifstream file(path, std::ios::binary);
+		std::string decoded = decode_data(file, root, static_cast<long long>(bit_count));
+		if (decoded.size() != input.data.size())
+			state.SkipWithError("decoded size mismatch");
+		benchmark::DoNotOptimize(decoded.data());
+	}
+	report(state, input, packed.size());
+	std::remove(path.c_str());
+}
+
+static void BM_decode_symbols(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(input.data, frequency);
+	CodeLengths lengths;
+	build_code_lengths(frequency, DEFAULT_MAX_CODE_LENGTH, lengths);
+	CodeTable codes{};
+	build_canonical_codes(lengths, codes);
+	DecodeTable table;
+	build_decode_table(codes, table);
+	std::vector<unsigned char> packed;
+	encode_data(bytes(input.data), input.data.size(), codes, packed);
+
+	std::vector<unsigned char> decoded(input.data.size());
+	for (auto _ : state)
+	{
+		if (decode_symbols(packed.data(), packed.size(), table, decoded.data(), decoded.size()) != decoded.size())
+			state.SkipWithError("decoded size mismatch");
+		benchmark::DoNotOptimize(decoded.data());
+	}
+	report(state, input, packed.size());
+}
+
+// Function to time one compress_data / decompress_file round trip layout
+static void round_trip(benchmark::State &state, const CompressionOptions &options, bool decompress)
+{
+	const Corpus &input = corpus(state);
+	const std::string compressed = scratch_path(input.name + "_huff");
+	const std::string restored = scratch_path(input.name + "_out");
+	HuffmanStatus status = compress_data(bytes(input.data), input.data.size(), compressed, options);
+	for (auto _ : state)
+	{
+		if (status != HuffmanStatus::OK)
+		{
+			state.SkipWithError(status_message(status));
+			break;
+		}
+		status = decompress ? decompress_file(compressed, restored, options)
+							: compress_data(bytes(input.data), input.data.size(), compressed, options);
+	}
+
+	std::ifstream written(compressed, std::ios::binary | std::ios::ate);
+	report(state, input, static_cast<size_t>(written.tellg()));
+	written.close();
+	std::remove(compressed.c_str());
+	std::remove(restored.c_str());
+}
+
+static void BM_compress_file(benchmark::State &state)
+{
+	round_trip(state, CompressionOptions(), false);
+}
+
+// Codes estimated from 1/DEFAULT_SAMPLE_STEP of the data, against BM_compress_file's ratio
+static void BM_compress_file_sampled(benchmark::State &state)
+{
+	CompressionOptions options;
+	options.sample_step = DEFAULT_SAMPLE_STEP;
+	round_trip(state, options, false);
+}
+
+static void BM_decompress_file(benchmark::State &state)
+{
+	round_trip(state, CompressionOptions(), true);
+}
+
+static void BM_compress_file_blocks(benchmark::State &state)
+{
+	CompressionOptions options;
+	options.block_size = DEFAULT_BLOCK_SIZE;
+	round_trip(state, options, false);
+}
+
+static void BM_compress_file_blocks_sampled(benchmark::State &state)
+{
+	CompressionOptions options;
+	options.block_size = DEFAULT_BLOCK_SIZE;
+	options.sample_step = DEFAULT_SAMPLE_STEP;
+	round_trip(state, options, false);
+}
+
+static void BM_decompress_file_blocks(benchmark::State &state)
+{
+	CompressionOptions options;
+	options.block_size = DEFAULT_BLOCK_SIZE;
+	round_trip(state, options, true);
+}
+
+// Records of BATCH_RECORD_SIZE bytes cut from the corpus, as many small messages
+constexpr size_t BATCH_RECORD_SIZE = 256;
+
+static std::vector<BatchRecord> batch_records(const Corpus &input)
+{
+	std::vector<BatchRecord> records;
+	for (size_t offset = 0; offset < input.data.size(); offset += BATCH_RECORD_SIZE)
+		records.push_back({bytes(input.data) + offset, std::min(BATCH_RECORD_SIZE, input.data.size() - offset)});
+	return records;
+}
+
+static void BM_compress_batch(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::vector<BatchRecord> records = batch_records(input);
+	std::vector<unsigned char> out;
+	for (auto _ : state)
+	{
+		out.clear();
+		compress_batch(records, out);
+		benchmark::DoNotOptimize(out.data());
+	}
+	report(state, input, out.size());
+}
+
+static void BM_decompress_batch(benchmark::State &state)
+{
+	const Corpus &input = corpus(state);
+	std::vector<unsigned char> batch;
+	compress_batch(batch_records(input), batch);
+	BatchDecoder decoder;
+	decoder.open(batch.data(), batch.size());
+	std::vector<std::vector<unsigned char>> records;
+	for (auto _ : state)
+	{
+		decoder.decode_all(records);
+		benchmark::DoNotOptimize(records.data());
+	}
+	report(state, input, batch.size());
+}
+
+// Function to run a benchmark over every corpus; the file and thread pool
+// benchmarks measure wall time, the rest is spent in other threads or the kernel
+static void over_corpora(benchmark::internal::Benchmark *benchmark)
+{
+	for (size_t k = 0; k < corpora().size(); ++k)
+		benchmark->Arg(static_cast<int64_t>(k));
+	benchmark->Unit(benchmark::kMillisecond);
+}
+
+// Function to run a benchmark over every corpus under the code length limits
+// the decoders special-case (0 for none): the primary table bits and one over
+// them, and the default
+static void over_corpora_and_limits(benchmark::internal::Benchmark *benchmark)
+{
+	for (size_t k = 0; k < corpora().size(); ++k)
+		for (int max_code_length : {0, DECODE_TABLE_BITS, DECODE_TABLE_BITS + 1, DEFAULT_MAX_CODE_LENGTH})
+			benchmark->Args({static_cast<int64_t>(k), max_code_length});
+	benchmark->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK(BM_fill_frequency)->Apply(over_corpora);
+BENCHMARK(BM_sample_frequency)->Apply(over_corpora);
+BENCHMARK(BM_build_huffman_tree)->Apply(over_corpora)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_build_code_lengths)->Apply(over_corpora_and_limits);
+BENCHMARK(BM_generate_dictionary)->Apply(over_corpora)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_encode_text)->Apply(over_corpora);
+BENCHMARK(BM_encode_data)->Apply(over_corpora);
+BENCHMARK(BM_write_compressed_file)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_decode_data)->Apply(over_corpora);
+BENCHMARK(BM_decode_symbols)->Apply(over_corpora);
+BENCHMARK(BM_compress_file)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_compress_file_sampled)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_decompress_file)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_compress_file_blocks)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_compress_file_blocks_sampled)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_decompress_file_blocks)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_compress_batch)->Apply(over_corpora)->UseRealTime();
+BENCHMARK(BM_decompress_batch)->Apply(over_corpora)->UseRealTime();
+
+BENCHMARK_MAIN();
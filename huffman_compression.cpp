@@ -4,10 +4,13 @@
  */
 
 #include "huffman_compression.h"
+#include "huffman_alphabet.h"
+#include "huffman_format.h"
+#include "huffman_mmap.h"
+#include "huffman_pairs.h"
+#include "huffman_parallel.h"
 
-constexpr int NUM_CHAR = 256; // 256 possible characters
-
-
+#include <ostream>
 
 // Function to initialize the frequency table
 void init_frequency(std::array<unsigned int, NUM_CHAR> &frequency)
@@ -18,26 +21,109 @@ void init_frequency(std::array<unsigned int, NUM_CHAR> &frequency)
 // Function to fill the frequency table based on the input text
 void fill_frequency(const std::string &text, std::array<unsigned int, NUM_CHAR> &frequency)
 {
-	for (unsigned char ch : text)
+	fill_frequency(reinterpret_cast<const unsigned char *>(text.data()), text.size(), frequency);
+}
+
+// Function to count bytes into four sub-tables. Bytes go round-robin to
+// them, so a run of the same byte increments four independent counters
+// instead of waiting on the store of a single one.
+static void count_split(const unsigned char *data, size_t size, std::array<std::array<unsigned int, NUM_CHAR>, 4> &counts)
+{
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		counts[0][word & 0xFF]++;
+		counts[1][(word >> 8) & 0xFF]++;
+		counts[2][(word >> 16) & 0xFF]++;
+		counts[3][(word >> 24) & 0xFF]++;
+		counts[0][(word >> 32) & 0xFF]++;
+		counts[1][(word >> 40) & 0xFF]++;
+		counts[2][(word >> 48) & 0xFF]++;
+		counts[3][word >> 56]++;
+	}
+	for (; i < size; ++i)
+	{
+		counts[0][data[i]]++;
+	}
+}
+
+// Function to fill the frequency table based on a block of bytes
+void fill_frequency(const unsigned char *data, size_t size, std::array<unsigned int, NUM_CHAR> &frequency)
+{
+	constexpr size_t SPLIT_THRESHOLD = 1024; // Below this clearing the sub-tables costs more than it saves
+
+	if (size < SPLIT_THRESHOLD)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			frequency[data[i]]++;
+		}
+		return;
+	}
+
+	std::array<std::array<unsigned int, NUM_CHAR>, 4> counts{};
+	count_split(data, size, counts);
+	for (int ch = 0; ch < NUM_CHAR; ++ch)
 	{
-		frequency[ch]++;
+		frequency[ch] += counts[0][ch] + counts[1][ch] + counts[2][ch] + counts[3][ch];
+	}
+}
+
+// Function to estimate the frequency table from a strided sample of runs
+void sample_frequency(const unsigned char *data, size_t size, unsigned step, std::array<unsigned int, NUM_CHAR> &frequency)
+{
+	const size_t stride = static_cast<size_t>(step) * SAMPLE_RUN_SIZE;
+	if (step <= 1 || size / stride < SAMPLE_MIN_RUNS)
+	{
+		fill_frequency(data, size, frequency);
+		return;
+	}
+
+	std::array<std::array<unsigned int, NUM_CHAR>, 4> counts{};
+	uint64_t sampled = 0;
+	for (size_t offset = 0; offset < size; offset += stride)
+	{
+		const size_t run = std::min(SAMPLE_RUN_SIZE, size - offset);
+		count_split(data + offset, run, counts);
+		sampled += run;
+	}
+
+	std::array<uint64_t, NUM_CHAR> sample;
+	int distinct = 0;
+	for (int ch = 0; ch < NUM_CHAR; ++ch)
+	{
+		sample[ch] = static_cast<uint64_t>(counts[0][ch]) + counts[1][ch] + counts[2][ch] + counts[3][ch];
+		distinct += sample[ch] != 0;
+	}
+	if (distinct == 1)
+	{
+		fill_frequency(data, size, frequency);
+		return;
+	}
+
+	// Scale the sample up to the whole input, bytes it missed still get a code
+	for (int ch = 0; ch < NUM_CHAR; ++ch)
+	{
+		frequency[ch] += static_cast<unsigned int>(std::max<uint64_t>(1, (sample[ch] * size + sampled / 2) / sampled));
 	}
 }
 
 // Function to print the frequency table (for debugging purposes)
-void print_frequency(const std::array<unsigned int, NUM_CHAR> &frequency)
+void print_frequency(const std::array<unsigned int, NUM_CHAR> &frequency, std::ostream &out)
 {
-	std::cout << "Frequency Table:\n";
+	out << "Frequency Table:\n";
 	for (int i = 0; i < NUM_CHAR; ++i)
 	{
 		if (frequency[i] > 0)
 		{
-			std::cout << i << " ('" << static_cast<char>(i) << "') : " << frequency[i] << "\n";
+			out << i << " ('" << static_cast<char>(i) << "') : " << frequency[i] << "\n";
 		}
 	}
 }
 
-// Build Huffman Tree based on frequency table
+// Build Huffman Tree based on frequency table (pointer tree for debugging)
 std::shared_ptr<Node> build_huffman_tree(const std::array<unsigned int, NUM_CHAR> &frequency)
 {
 	std::priority_queue<std::shared_ptr<Node>, std::vector<std::shared_ptr<Node>>, Node::Compare> pq;
@@ -51,6 +137,18 @@ std::shared_ptr<Node> build_huffman_tree(const std::array<unsigned int, NUM_CHAR
 		}
 	}
 
+	// No symbols, no tree
+	if (pq.empty())
+		return nullptr;
+
+	// A lone symbol hangs below a root of its own, so its code is "0" rather than empty
+	if (pq.size() == 1)
+	{
+		auto root = std::make_shared<Node>('+', pq.top()->frequency);
+		root->left = pq.top();
+		return root;
+	}
+
 	while (pq.size() > 1)
 	{
 		auto left = pq.top();
@@ -66,9 +164,31 @@ std::shared_ptr<Node> build_huffman_tree(const std::array<unsigned int, NUM_CHAR
 	return pq.top(); // Root of the tree
 }
 
+// Build the Huffman code lengths on a fixed node array, see
+// build_symbol_code_lengths
+void build_huffman_code_lengths(const std::array<unsigned int, NUM_CHAR> &frequency, CodeLengths &lengths)
+{
+	build_symbol_code_lengths<NUM_CHAR>(frequency, lengths);
+}
+
+// Function to compute the code lengths under the optional limit
+void build_code_lengths(const std::array<unsigned int, NUM_CHAR> &frequency, int max_code_length, CodeLengths &lengths)
+{
+	build_symbol_code_lengths<NUM_CHAR>(frequency, max_code_length, lengths);
+}
+
+// Build optimal code lengths bounded by max_code_length (package-merge), see
+// build_symbol_length_limited_code_lengths
+bool build_length_limited_code_lengths(const std::array<unsigned int, NUM_CHAR> &frequency, int max_code_length, CodeLengths &lengths)
+{
+	return build_symbol_length_limited_code_lengths<NUM_CHAR>(frequency, max_code_length, lengths);
+}
+
 // Recursive function to generate the Huffman dictionary from the tree
 void generate_dictionary(const std::shared_ptr<Node> &root, std::string code, std::array<std::string, NUM_CHAR> &dict)
 {
+	if (!root)
+		return; // Empty input
 	if (!root->left && !root->right)
 	{ // Leaf node
 		dict[root->character] = code;
@@ -81,15 +201,71 @@ void generate_dictionary(const std::shared_ptr<Node> &root, std::string code, st
 		generate_dictionary(root->right, code + '1', dict);
 }
 
+// Recursive function to generate the packed Huffman codes from the tree
+void generate_codes(const std::shared_ptr<Node> &root, uint64_t bits, int length, CodeTable &codes)
+{
+	if (!root)
+		return; // Empty input
+	if (!root->left && !root->right)
+	{ // Leaf node
+		codes[root->character] = Codeword{bits, static_cast<uint8_t>(length)};
+		return;
+	}
+
+	if (root->left)
+		generate_codes(root->left, bits << 1, length + 1, codes);
+	if (root->right)
+		generate_codes(root->right, (bits << 1) | 1, length + 1, codes);
+}
+
+// Function to extract the code length of every symbol
+void get_code_lengths(const CodeTable &codes, CodeLengths &lengths)
+{
+	for (int i = 0; i < NUM_CHAR; ++i)
+	{
+		lengths[i] = codes[i].length;
+	}
+}
+
+// Function to assign canonical codes: shorter codes first, ties broken by symbol
+bool build_canonical_codes(const CodeLengths &lengths, CodeTable &codes)
+{
+	return build_symbol_canonical_codes<NUM_CHAR>(lengths, codes);
+}
+
+// Function to append the code lengths: a zero byte starts a run of unused
+// symbols whose size minus one follows, any other byte is a single length
+void write_code_lengths(std::vector<unsigned char> &out, const CodeLengths &lengths)
+{
+	write_symbol_code_lengths<NUM_CHAR>(out, lengths);
+}
+
+// Function to parse the code lengths written by write_code_lengths
+size_t read_code_lengths(const unsigned char *data, size_t size, CodeLengths &lengths)
+{
+	return read_symbol_code_lengths<NUM_CHAR>(data, size, lengths);
+}
+
+// Function to compute the size in bits of the encoded text
+uint64_t encoded_bit_length(const std::array<unsigned int, NUM_CHAR> &frequency, const CodeTable &codes)
+{
+	uint64_t bits = 0;
+	for (int i = 0; i < NUM_CHAR; ++i)
+	{
+		bits += static_cast<uint64_t>(frequency[i]) * codes[i].length;
+	}
+	return bits;
+}
+
 // Function to print the generated dictionary (for debugging)
-void print_dictionary(const std::array<std::string, NUM_CHAR> &dict)
+void print_dictionary(const std::array<std::string, NUM_CHAR> &dict, std::ostream &out)
 {
-	std::cout << "Huffman Dictionary:\n";
+	out << "Huffman Dictionary:\n";
 	for (int i = 0; i < NUM_CHAR; ++i)
 	{
 		if (!dict[i].empty())
 		{
-			std::cout << i << " ('" << static_cast<char>(i) << "') : " << dict[i] << "\n";
+			out << i << " ('" << static_cast<char>(i) << "') : " << dict[i] << "\n";
 		}
 	}
 }
@@ -105,111 +281,329 @@ std::string encode_text(const std::string &text, const std::array<std::string, N
 	return encoded;
 }
 
-// Function to write the Huffman dictionary and encoded data into a binary file
-void write_compressed_file(const std::string &huffman_name, const std::array<std::string, NUM_CHAR> &dict, const std::string &encoded_text)
+// Function to encode the input text straight into packed bits
+uint64_t encode_data(const std::string &text, const CodeTable &codes, std::vector<unsigned char> &packed)
 {
-	std::ofstream outfile(huffman_name, std::ios::binary);
+	return encode_data(reinterpret_cast<const unsigned char *>(text.data()), text.size(), codes, packed);
+}
 
-	if (!outfile.is_open())
-	{
-		std::cerr << "ERROR CREATING HUFFMAN FILE.\n";
-		return;
-	}
+// Function to encode a block of bytes straight into packed bits
+uint64_t encode_data(const unsigned char *data, size_t size, const CodeTable &codes, std::vector<unsigned char> &packed)
+{
+	return encode_symbols(data, size, codes, packed);
+}
 
-	// Write dictionary
-	char dict_size = static_cast<char>(std::count_if(dict.begin(), dict.end(), [](const std::string &s)
-													 { return !s.empty(); }));
+// Function to write the Huffman dictionary into the compressed file
+void write_huffman_dictionary(std::ofstream &outfile, const CodeTable &codes)
+{
+	char dict_size = static_cast<char>(std::count_if(codes.begin(), codes.end(), [](const Codeword &c)
+													 { return c.length != 0; }));
 	outfile.write(&dict_size, sizeof(char));
 
 	for (int i = 0; i < NUM_CHAR; ++i)
 	{
-		if (!dict[i].empty())
+		if (codes[i].length != 0)
 		{
 			char character = static_cast<char>(i);
-			char length = static_cast<char>(dict[i].length());
+			char length = static_cast<char>(codes[i].length);
+			char code[64];
+			for (int bit = 0; bit < codes[i].length; ++bit)
+			{
+				code[bit] = ((codes[i].bits >> (codes[i].length - 1 - bit)) & 1) ? '1' : '0';
+			}
 			outfile.write(&character, sizeof(char));
 			outfile.write(&length, sizeof(char));
-			outfile.write(dict[i].c_str(), length); // Write binary representation
+			outfile.write(code, length); // Write binary representation
 		}
 	}
+}
 
-	// Write encoded text as binary data
-	char buffer = 0;
-	int bit_pos = 0;
-
-	for (char bit : encoded_text)
+// Function to write the Huffman dictionary and encoded data into a binary file
+HuffmanStatus write_compressed_file(const std::string &huffman_name, const std::array<std::string, NUM_CHAR> &dict, const std::string &encoded_text)
+{
+	CodeTable codes{};
+	for (int i = 0; i < NUM_CHAR; ++i)
 	{
-		if (bit == '1')
+		for (char bit : dict[i])
 		{
-			buffer |= (1 << (7 - bit_pos));
+			codes[i].bits = (codes[i].bits << 1) | (bit == '1' ? 1u : 0u);
 		}
-		bit_pos++;
-		if (bit_pos == 8)
+		codes[i].length = static_cast<uint8_t>(dict[i].length());
+	}
+
+	// Pack the '0'/'1' characters into bits
+	std::vector<unsigned char> packed;
+	packed.reserve(encoded_text.size() / 8 + 1);
+	BitWriter writer(packed);
+	for (char bit : encoded_text)
+	{
+		writer.put(bit == '1' ? 1 : 0, 1);
+	}
+	writer.flush();
+
+	// Only the code string is known here, walk it to recover the original
+	// bytes for the size and checksum of the header
+	std::shared_ptr<Node> root = std::make_shared<Node>('+', 0);
+	build_tree_from_codes(codes, root);
+	std::string original;
+	std::shared_ptr<Node> current = root;
+	for (char bit : encoded_text)
+	{
+		current = bit == '1' ? current->right : current->left;
+		if (!current)
+			break;
+		if (!current->left && !current->right)
 		{
-			outfile.write(&buffer, sizeof(char));
-			buffer = 0;
-			bit_pos = 0;
+			original += static_cast<char>(current->character);
+			current = root;
 		}
 	}
 
-	// Write any remaining bits
-	if (bit_pos > 0)
+	// Arbitrary tree codes need the explicit dictionary
+	FileHeader header;
+	header.final_bits = static_cast<uint8_t>(encoded_text.empty() ? 0 : (encoded_text.size() - 1) % 8 + 1);
+	header.original_size = original.size();
+	header.checksum = crc32c(reinterpret_cast<const unsigned char *>(original.data()), original.size());
+	return write_compressed_file(huffman_name, header, codes, packed);
+}
+
+// Function to write the container header, the Huffman dictionary and packed
+// data into a binary file
+HuffmanStatus write_compressed_file(const std::string &huffman_name, const FileHeader &header, const CodeTable &codes, const std::vector<unsigned char> &packed,
+									uint64_t *file_size)
+{
+	std::ofstream outfile(huffman_name, std::ios::binary);
+
+	if (!outfile.is_open())
+		return HuffmanStatus::HUFFMAN_CREATE_FAILED;
+
+	std::vector<unsigned char> prefix;
+	write_file_header(prefix, header);
+
+	// Write dictionary
+	if (header.flags & FILE_FLAG_CANONICAL)
+	{
+		CodeLengths lengths;
+		get_code_lengths(codes, lengths);
+		write_code_lengths(prefix, lengths);
+		outfile.write(reinterpret_cast<const char *>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+	}
+	else
 	{
-		outfile.write(&buffer, sizeof(char));
+		outfile.write(reinterpret_cast<const char *>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+		write_huffman_dictionary(outfile, codes);
 	}
 
+	// Write encoded text as binary data
+	outfile.write(reinterpret_cast<const char *>(packed.data()), static_cast<std::streamsize>(packed.size()));
+
+	const std::streamoff written = outfile.tellp();
 	outfile.close();
-	std::cout << "File compressed successfully.\n";
+	if (!outfile)
+		return HuffmanStatus::HUFFMAN_WRITE_FAILED;
+	if (file_size != nullptr)
+		*file_size = static_cast<uint64_t>(written);
+	return HuffmanStatus::OK;
+}
+
+// Function to describe a status
+const char *status_message(HuffmanStatus status)
+{
+	switch (status)
+	{
+	case HuffmanStatus::OK:
+		return "OK.";
+	case HuffmanStatus::INPUT_OPEN_FAILED:
+		return "ERROR OPENING INPUT FILE.";
+	case HuffmanStatus::INPUT_READ_FAILED:
+		return "ERROR READING INPUT FILE.";
+	case HuffmanStatus::HUFFMAN_OPEN_FAILED:
+		return "ERROR OPENING HUFFMAN FILE.";
+	case HuffmanStatus::HUFFMAN_CREATE_FAILED:
+		return "ERROR CREATING HUFFMAN FILE.";
+	case HuffmanStatus::HUFFMAN_WRITE_FAILED:
+		return "ERROR WRITING HUFFMAN FILE.";
+	case HuffmanStatus::HUFFMAN_READ_FAILED:
+		return "ERROR READING HUFFMAN FILE.";
+	case HuffmanStatus::DICTIONARY_READ_FAILED:
+		return "ERROR READING HUFFMAN DICTIONARY.";
+	case HuffmanStatus::DICTIONARY_MISSING:
+		return "ERROR: HUFFMAN FILE NEEDS A SHARED DICTIONARY.";
+	case HuffmanStatus::UNSUPPORTED_FORMAT:
+		return "ERROR: HUFFMAN FILE FORMAT NOT SUPPORTED.";
+	case HuffmanStatus::OUTPUT_CREATE_FAILED:
+		return "ERROR CREATING OUTPUT FILE.";
+	case HuffmanStatus::OUTPUT_WRITE_FAILED:
+		return "ERROR WRITING OUTPUT FILE.";
+	}
+	return "UNKNOWN ERROR.";
 }
 
 // Main compression function
-void compress_file(const std::string &dataset, const std::string &huffman_name)
+HuffmanStatus compress_file(const std::string &dataset, const std::string &huffman_name, const CompressionOptions &options)
+{
+	return compress_data(reinterpret_cast<const unsigned char *>(dataset.data()), dataset.size(), huffman_name, options);
+}
+
+// Function to compress a buffer into a Huffman file
+HuffmanStatus compress_data(const unsigned char *data, size_t size, const std::string &huffman_name, const CompressionOptions &options)
 {
+	if (options.block_size > 0)
+		return compress_file_blocks(data, size, huffman_name, options);
+
+	CompressionStats *stats = options.stats;
+
 	// Initialize frequency table
+	StageTimer histogram_timer(stat_field(stats, &CompressionStats::histogram_ns));
 	std::array<unsigned int, NUM_CHAR> frequency;
 	init_frequency(frequency);
 
-	// Fill frequency table based on dataset
-	fill_frequency(dataset, frequency);
+	// Fill frequency table based on dataset, or estimate it from a sample
+	sample_frequency(data, size, options.sample_step, frequency);
+	histogram_timer.stop();
+
+	// Build the code lengths on the flat Huffman tree
+	StageTimer tree_timer(stat_field(stats, &CompressionStats::tree_ns));
+	CodeLengths lengths;
+	build_code_lengths(frequency, options.max_code_length, lengths);
+
+	// Assign canonical codes, the explicit dictionary stores them as well
+	CodeTable codes{};
+	build_canonical_codes(lengths, codes);
+	tree_timer.stop();
+	if (stats != nullptr)
+	{
+		stats->bytes_in += size;
+		stats->symbols += size;
+		stats->distinct_symbols = std::max<int>(stats->distinct_symbols, static_cast<int>(std::count_if(frequency.begin(), frequency.end(), [](unsigned int count)
+																									   { return count != 0; })));
+		stats->max_code_length = std::max<int>(stats->max_code_length, *std::max_element(lengths.begin(), lengths.end()));
+	}
 
-	// Build Huffman Tree
-	std::shared_ptr<Node> huffman_tree = build_huffman_tree(frequency);
+	// The interleaved decoder needs codes that fit the lookup tables
+	const bool interleaved = options.interleaved && *std::max_element(lengths.begin(), lengths.end()) <= MAX_TABLE_CODE_LENGTH;
 
-	// Generate Huffman dictionary
-	std::array<std::string, NUM_CHAR> dict;
-	generate_dictionary(huffman_tree, "", dict);
+	FileHeader header;
+	header.flags = (options.canonical ? FILE_FLAG_CANONICAL : 0) | (interleaved ? FILE_FLAG_INTERLEAVED : 0);
+	header.original_size = size;
+	StageTimer checksum_timer(stat_field(stats, &CompressionStats::io_ns));
+	header.checksum = crc32c(data, size);
+	checksum_timer.stop();
 
-	// Encode the input text
-	std::string encoded_text = encode_text(dataset, dict);
+	// Repetitive text may code smaller with frequent byte pairs as symbols of their own
+	if (options.byte_pairs && options.canonical && size > 0)
+	{
+		StageTimer pair_timer(stat_field(stats, &CompressionStats::code_ns));
+		std::vector<unsigned char> file;
+		write_file_header(file, header);
+		uint64_t pair_bits = encode_byte_pairs(data, size, options.max_code_length, file);
+		pair_timer.stop();
+
+		std::vector<unsigned char> table;
+		write_code_lengths(table, lengths);
+		if (file.size() < FILE_HEADER_SIZE + table.size() + (encoded_bit_length(frequency, codes) + 7) / 8)
+		{
+			file[5] = FILE_FLAG_CANONICAL | FILE_FLAG_BYTE_PAIRS; // flags
+			file[6] = static_cast<unsigned char>((pair_bits - 1) % 8 + 1); // final_bits
+
+			StageTimer io_timer(stat_field(stats, &CompressionStats::io_ns));
+			std::ofstream outfile(huffman_name, std::ios::binary);
+			if (!outfile.is_open())
+				return HuffmanStatus::HUFFMAN_CREATE_FAILED;
+			outfile.write(reinterpret_cast<const char *>(file.data()), static_cast<std::streamsize>(file.size()));
+			outfile.close();
+			if (!outfile)
+				return HuffmanStatus::HUFFMAN_WRITE_FAILED;
+			io_timer.stop();
+			if (stats != nullptr)
+				stats->bytes_out += file.size();
+			if (options.progress)
+				options.progress(size, size);
+			return HuffmanStatus::OK;
+		}
+	}
+
+	// Encode the input text into an exactly sized buffer
+	StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+	std::vector<unsigned char> packed;
+	packed.reserve(static_cast<size_t>((encoded_bit_length(frequency, codes) + 7) / 8) + 4 * INTERLEAVED_STREAMS);
+	if (interleaved)
+	{
+		encode_data_interleaved(data, size, codes, packed);
+	}
+	else
+	{
+		uint64_t bit_count = encode_data(data, size, codes, packed);
+		header.final_bits = static_cast<uint8_t>(bit_count == 0 ? 0 : (bit_count - 1) % 8 + 1);
+	}
+	code_timer.stop();
 
 	// Write compressed file
-	write_compressed_file(huffman_name, dict, encoded_text);
+	StageTimer io_timer(stat_field(stats, &CompressionStats::io_ns));
+	uint64_t file_size = 0;
+	HuffmanStatus status = write_compressed_file(huffman_name, header, codes, packed, &file_size);
+	io_timer.stop();
+	if (status != HuffmanStatus::OK)
+		return status;
+	if (stats != nullptr)
+		stats->bytes_out += file_size;
+	if (options.progress)
+		options.progress(size, size);
+	return HuffmanStatus::OK;
 }
 
 
 // Function to read the Huffman dictionary from the file
-void read_huffman_dictionary(std::ifstream &infile, std::shared_ptr<Node> &root)
+bool read_huffman_dictionary(std::ifstream &infile, CodeTable &codes)
 {
-	char dict_size;
-	infile.read(&dict_size, sizeof(char)); // Read the size of the dictionary
+	char size_byte;
+	if (!infile.read(&size_byte, sizeof(char))) // Read the size of the dictionary
+		return false;
 
-	// For each character and its corresponding Huffman code, reconstruct the tree
+	// A full dictionary of 256 codes wraps around to 0
+	int dict_size = static_cast<unsigned char>(size_byte);
+	if (dict_size == 0)
+		dict_size = NUM_CHAR;
+
+	// For each character read its Huffman code
 	for (int i = 0; i < dict_size; ++i)
 	{
 		char character;
 		char code_length;
-		infile.read(&character, sizeof(char));
-		infile.read(&code_length, sizeof(char));
+		if (!infile.read(&character, sizeof(char)) || !infile.read(&code_length, sizeof(char)))
+			return false;
+		// Every stored symbol has a code, of at most the bits of a Codeword
+		if (code_length <= 0 || code_length > 64)
+			return false;
+
+		char code[64];
+		if (!infile.read(code, code_length))
+			return false;
 
-		std::string code;
-		code.resize(code_length);
-		infile.read(&code[0], code_length);
+		Codeword &codeword = codes[static_cast<unsigned char>(character)];
+		codeword.bits = 0;
+		for (int bit = 0; bit < code_length; ++bit)
+		{
+			codeword.bits = (codeword.bits << 1) | (code[bit] == '1' ? 1u : 0u);
+		}
+		codeword.length = static_cast<uint8_t>(code_length);
+	}
+	return static_cast<bool>(infile);
+}
+
+// Function to rebuild the Huffman tree from the codes
+void build_tree_from_codes(const CodeTable &codes, std::shared_ptr<Node> &root)
+{
+	for (int i = 0; i < NUM_CHAR; ++i)
+	{
+		if (codes[i].length == 0)
+			continue;
 
 		// Insert the character into the Huffman tree based on its code
 		std::shared_ptr<Node> current = root;
-		for (char bit : code)
+		for (int bit = codes[i].length - 1; bit >= 0; --bit)
 		{
-			if (bit == '0')
+			if (((codes[i].bits >> bit) & 1) == 0)
 			{
 				if (!current->left)
 				{
@@ -226,83 +620,459 @@ void read_huffman_dictionary(std::ifstream &infile, std::shared_ptr<Node> &root)
 				current = current->right;
 			}
 		}
-		current->character = static_cast<unsigned char>(character); // Assign the character to the leaf node
+		current->character = static_cast<unsigned char>(i); // Assign the character to the leaf node
 	}
 }
 
-// Function to decode the binary data using the Huffman tree
-std::string decode_data(std::ifstream &infile, std::shared_ptr<Node> &root, int encoded_length)
+// Function to build the decode lookup tables from the codes
+bool build_decode_table(const CodeTable &codes, DecodeTable &table)
 {
-	std::string decoded_text;
-	std::shared_ptr<Node> current = root;
+	return build_symbol_decode_table<NUM_CHAR>(codes, table);
+}
 
-	char buffer;
-	int bit_count = 0;
-	while (infile.read(&buffer, sizeof(char)))
+// Function to build the flat decoding tree from the codes
+bool build_decode_tree(const CodeTable &codes, DecodeTree &tree)
+{
+	tree.nodes.reserve(NUM_CHAR - 1);
+	tree.nodes.assign(1, {{0, 0}});
+	for (int i = 0; i < NUM_CHAR; ++i)
 	{
-		for (int i = 7; i >= 0; --i)
+		if (codes[i].length == 0)
+			continue;
+		if (codes[i].length > 64)
+			return false;
+
+		// Follow the code from the root, adding the internal nodes it needs
+		size_t node = 0;
+		for (int bit = codes[i].length - 1; bit > 0; --bit)
 		{
-			bool bit = (buffer & (1 << i)) != 0;
+			const int branch = (codes[i].bits >> bit) & 1;
+			if (tree.nodes[node][branch] & DECODE_TREE_LEAF)
+				return false; // A shorter code is a prefix of this one
+			if (tree.nodes[node][branch] == 0)
+			{
+				if (tree.nodes.size() >= NUM_CHAR - 1)
+					return false;
+				tree.nodes[node][branch] = static_cast<uint16_t>(tree.nodes.size());
+				tree.nodes.push_back({{0, 0}});
+			}
+			node = tree.nodes[node][branch];
+		}
+		uint16_t &leaf = tree.nodes[node][codes[i].bits & 1];
+		if (leaf != 0)
+			return false; // Another code is equal to or starts with this one
+		leaf = static_cast<uint16_t>(DECODE_TREE_LEAF | i);
+	}
+	return true;
+}
 
-			// Traverse the Huffman tree based on the bit
-			if (bit)
+// Function to decode exactly count symbols by walking the flat tree
+size_t decode_symbols_tree(const unsigned char *data, size_t size, const DecodeTree &tree, unsigned char *out, size_t count)
+{
+	size_t produced = 0;
+	uint16_t node = 0;
+	for (size_t i = 0; i < size && produced < count; ++i)
+	{
+		for (int bit = 7; bit >= 0 && produced < count; --bit)
+		{
+			const uint16_t child = tree.nodes[node][(data[i] >> bit) & 1];
+			if (child == 0)
+				return produced; // No code takes this branch
+			if (child & DECODE_TREE_LEAF)
 			{
-				current = current->right;
+				out[produced++] = static_cast<unsigned char>(child & 0xFF);
+				node = 0;
 			}
 			else
 			{
-				current = current->left;
+				node = child;
 			}
+		}
+	}
+	return produced;
+}
+
+// Function to decode the binary data using the Huffman tree
+std::string decode_data(const unsigned char *data, size_t size, const std::shared_ptr<Node> &root, long long encoded_length)
+{
+	std::string decoded_text;
+	const Node *current = root.get(); // Plain pointer, the walk does not touch reference counts
+
+	long long bit_count = 0;
+	for (size_t byte = 0; byte < size && bit_count < encoded_length; ++byte)
+	{
+		for (int i = 7; i >= 0 && bit_count < encoded_length; --i, ++bit_count)
+		{
+			// Traverse the Huffman tree based on the bit
+			current = (data[byte] & (1 << i)) != 0 ? current->right.get() : current->left.get();
+			if (current == nullptr)
+				return decoded_text; // No code takes this branch
 
 			// If we reach a leaf node, we append the character to the decoded text
 			if (!current->left && !current->right)
 			{
 				decoded_text += current->character;
-				current = root; // Go back to the root for the next character
+				current = root.get(); // Go back to the root for the next character
 			}
-			bit_count++;
-			if (bit_count >= encoded_length)
-				break; // Stop when we decode the full length of encoded data
 		}
 	}
 
 	return decoded_text;
 }
 
+std::string decode_data(std::ifstream &infile, std::shared_ptr<Node> &root, long long encoded_length)
+{
+	// Read only the bytes holding encoded_length bits, or what is left of the file
+	std::vector<unsigned char> data;
+	unsigned char buffer[4096];
+	uint64_t wanted = encoded_length > 0 ? (static_cast<uint64_t>(encoded_length) + 7) / 8 : 0;
+	while (data.size() < wanted && infile)
+	{
+		infile.read(reinterpret_cast<char *>(buffer), static_cast<std::streamsize>(std::min<uint64_t>(sizeof(buffer), wanted - data.size())));
+		data.insert(data.end(), buffer, buffer + infile.gcount());
+	}
+	return decode_data(data.data(), data.size(), root, encoded_length);
+}
+
+// Function to decode the binary data using the lookup tables
+std::string decode_data_table(const unsigned char *data, size_t size, const DecodeTable &table, long long bit_count)
+{
+	std::string decoded_text;
+	decoded_text.reserve(size * 2);
+
+	const unsigned char *end = data + size;
+	uint64_t bit_buffer = 0; // Next bits of the stream, MSB first
+	int buffered = 0;		 // Valid bits in bit_buffer
+	long long consumed = 0;	 // Bits decoded so far
+
+	while (consumed < bit_count)
+	{
+		// Refill up to 57 bits, zeros are shifted in past the end of the data
+		while (buffered <= 56 && data < end)
+		{
+			bit_buffer |= static_cast<uint64_t>(*data++) << (56 - buffered);
+			buffered += 8;
+		}
+
+		const DecodeEntry *entry = &table.entries[bit_buffer >> (64 - DECODE_TABLE_BITS)];
+		if (entry->sub_bits != 0)
+		{
+			uint64_t suffix = (bit_buffer << DECODE_TABLE_BITS) >> (64 - entry->sub_bits);
+			entry = &table.entries[entry->value + suffix];
+		}
+		if (entry->length == 0)
+			break; // Not a valid code
+
+		if (entry->pair_length != 0 && consumed + entry->pair_length <= bit_count)
+		{
+			decoded_text += static_cast<char>(entry->value & 0xFF);
+			decoded_text += static_cast<char>((entry->value >> 16) & 0xFF);
+			bit_buffer <<= entry->pair_length;
+			buffered -= entry->pair_length;
+			consumed += entry->pair_length;
+		}
+		else
+		{
+			if (consumed + entry->length > bit_count)
+				break; // Code runs past the end of the encoded data
+			decoded_text += static_cast<char>(entry->value & 0xFF);
+			bit_buffer <<= entry->length;
+			buffered -= entry->length;
+			consumed += entry->length;
+		}
+	}
+
+	return decoded_text;
+}
+
+// Function to decode exactly count symbols using the lookup tables
+size_t decode_symbols(const unsigned char *data, size_t size, const DecodeTable &table, unsigned char *out, size_t count, int skip_bits)
+{
+	return decode_symbol_stream(data, size, table, out, count, skip_bits);
+}
+
+// Function to encode a block of bytes round-robin into interleaved bitstreams
+void encode_data_interleaved(const unsigned char *data, size_t size, const CodeTable &codes, std::vector<unsigned char> &out)
+{
+	std::array<std::vector<unsigned char>, INTERLEAVED_STREAMS> streams;
+	for (std::vector<unsigned char> &stream : streams)
+		stream.reserve(size / INTERLEAVED_STREAMS + 8);
+
+	{
+		BitWriter writer0(streams[0]), writer1(streams[1]), writer2(streams[2]), writer3(streams[3]);
+		size_t i = 0;
+		for (; i + INTERLEAVED_STREAMS <= size; i += INTERLEAVED_STREAMS)
+		{
+			writer0.put(codes[data[i]].bits, codes[data[i]].length);
+			writer1.put(codes[data[i + 1]].bits, codes[data[i + 1]].length);
+			writer2.put(codes[data[i + 2]].bits, codes[data[i + 2]].length);
+			writer3.put(codes[data[i + 3]].bits, codes[data[i + 3]].length);
+		}
+		BitWriter *writers[INTERLEAVED_STREAMS] = {&writer0, &writer1, &writer2, &writer3};
+		for (; i < size; ++i)
+			writers[i % INTERLEAVED_STREAMS]->put(codes[data[i]].bits, codes[data[i]].length);
+		for (BitWriter *writer : writers)
+			writer->flush();
+	}
+
+	for (int s = 0; s + 1 < INTERLEAVED_STREAMS; ++s)
+		write_le32(out, static_cast<uint32_t>(streams[s].size()));
+	for (const std::vector<unsigned char> &stream : streams)
+		out.insert(out.end(), stream.begin(), stream.end());
+}
+
+// Function to decode the interleaved bitstreams, one symbol of every stream per round
+size_t decode_symbols_interleaved(const unsigned char *data, size_t size, const DecodeTable &table, unsigned char *out, size_t count)
+{
+	constexpr size_t JUMP_TABLE_SIZE = 4 * (INTERLEAVED_STREAMS - 1);
+	if (size < JUMP_TABLE_SIZE)
+		return 0;
+
+	// Find the streams through the jump table
+	size_t offsets[INTERLEAVED_STREAMS + 1];
+	offsets[0] = JUMP_TABLE_SIZE;
+	for (int s = 0; s + 1 < INTERLEAVED_STREAMS; ++s)
+	{
+		offsets[s + 1] = offsets[s] + read_le32(data + 4 * s);
+		if (offsets[s + 1] > size)
+			return 0;
+	}
+	offsets[INTERLEAVED_STREAMS] = size;
+
+	BitReader reader0(data + offsets[0], offsets[1] - offsets[0]);
+	BitReader reader1(data + offsets[1], offsets[2] - offsets[1]);
+	BitReader reader2(data + offsets[2], offsets[3] - offsets[2]);
+	BitReader reader3(data + offsets[3], offsets[4] - offsets[3]);
+
+	// Every stream is decoded on its own dependency chain
+	auto decode_one = [&table](BitReader &reader, unsigned char &symbol)
+	{
+		const DecodeEntry &entry = table.lookup(reader.bits());
+		symbol = static_cast<unsigned char>(entry.value);
+		reader.consume(entry.length);
+		return entry.length != 0 && reader.available() >= 0;
+	};
+
+	size_t produced = 0;
+	while (produced + INTERLEAVED_STREAMS <= count && reader0.has_word() && reader1.has_word() && reader2.has_word() && reader3.has_word())
+	{
+		reader0.refill();
+		reader1.refill();
+		reader2.refill();
+		reader3.refill();
+
+		bool ok = decode_one(reader0, out[produced]);
+		ok &= decode_one(reader1, out[produced + 1]);
+		ok &= decode_one(reader2, out[produced + 2]);
+		ok &= decode_one(reader3, out[produced + 3]);
+		if (!ok)
+			return produced;
+		produced += INTERLEAVED_STREAMS;
+	}
+
+	BitReader *readers[INTERLEAVED_STREAMS] = {&reader0, &reader1, &reader2, &reader3};
+	for (; produced < count; ++produced)
+	{
+		BitReader &reader = *readers[produced % INTERLEAVED_STREAMS];
+		reader.refill();
+		if (!decode_one(reader, out[produced]))
+			break;
+	}
+
+	return produced;
+}
+
 // Decompression function
-void decompress_file(const std::string &huffman_filename, const std::string &output_filename)
+HuffmanStatus decompress_file(const std::string &huffman_filename, const std::string &output_filename, const CompressionOptions &options)
 {
-	std::ifstream infile(huffman_filename, std::ios::binary);
-	if (!infile.is_open())
+	// Map the compressed file, the table decoder reads straight from the mapping
+	MappedInput input;
+	if (!input.open(huffman_filename))
+		return HuffmanStatus::HUFFMAN_OPEN_FAILED;
+
+	// The container header says how the file was written, older files go by the options
+	FileHeader header;
+	const HeaderStatus header_status = read_file_header(input.data(), input.size(), header);
+	if (header_status == HeaderStatus::UNSUPPORTED)
+		return HuffmanStatus::UNSUPPORTED_FORMAT;
+	const bool has_header = header_status == HeaderStatus::OK;
+	if (has_header ? (header.flags & FILE_FLAG_BLOCKED) != 0 : options.block_size > 0)
 	{
-		std::cerr << "ERROR OPENING HUFFMAN FILE.\n";
-		return;
+		input.close();
+		return decompress_file_blocks(huffman_filename, output_filename, options);
 	}
 
-	// Reconstruct the Huffman tree from the file
-	std::shared_ptr<Node> root = std::make_shared<Node>('+', 0);
-	read_huffman_dictionary(infile, root);
+	// Counts a successfully decoded file of produced bytes
+	CompressionStats *stats = options.stats;
+	const uint64_t input_size = input.size();
+	auto count_file = [&](uint64_t produced)
+	{
+		if (stats != nullptr)
+		{
+			stats->bytes_in += input_size;
+			stats->bytes_out += produced;
+			stats->symbols += produced;
+		}
+		if (options.progress)
+			options.progress(produced, produced);
+	};
+	if (has_header && (header.flags & FILE_FLAG_DICTIONARY))
+		return HuffmanStatus::DICTIONARY_MISSING;
+	if (has_header && (header.flags & FILE_FLAG_BYTE_PAIRS) && header.original_size > 0)
+	{
+		// Every pair symbol takes at least one bit and spells at most two bytes
+		const uint64_t payload_bytes = input.size() - FILE_HEADER_SIZE;
+		if (header.original_size > 2 * 8 * payload_bytes)
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
 
-	// Get the length of the encoded data (optional if not explicitly stored)
-	infile.seekg(0, std::ios::end);
-	std::streampos file_size = infile.tellg();
-	infile.seekg(-1, std::ios::cur); // Assume we are reading the last byte for length of encoded data
-	int encoded_length = static_cast<int>(file_size);
+		// Pair symbols decode straight into their bytes in the pre-sized output
+		const size_t size = static_cast<size_t>(header.original_size);
+		MappedOutput output;
+		if (!output.create(output_filename, size))
+			return HuffmanStatus::OUTPUT_CREATE_FAILED;
+		StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+		if (!decode_byte_pairs(input.data() + FILE_HEADER_SIZE, input.size() - FILE_HEADER_SIZE, output.data(), size))
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
+		code_timer.stop();
+		StageTimer io_timer(stat_field(stats, &CompressionStats::io_ns));
+		if (crc32c(output.data(), size) != header.checksum)
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
+		if (!output.commit())
+			return HuffmanStatus::OUTPUT_WRITE_FAILED;
+		io_timer.stop();
+		count_file(size);
+		return HuffmanStatus::OK;
+	}
+	const size_t header_size = has_header ? FILE_HEADER_SIZE : 0;
+	const bool canonical = has_header ? (header.flags & FILE_FLAG_CANONICAL) != 0 : options.canonical;
+	const bool interleaved = has_header && (header.flags & FILE_FLAG_INTERLEAVED) != 0;
 
-	// Decode the binary data using the Huffman tree
-	std::string decoded_text = decode_data(infile, root, encoded_length);
+	// An empty input has no codes to read (an explicit dictionary cannot even say so)
+	if (has_header && header.original_size == 0)
+	{
+		MappedOutput output;
+		if (header.checksum != crc32c(nullptr, 0) || !output.create(output_filename, 0) || !output.commit())
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
+		count_file(0);
+		return HuffmanStatus::OK;
+	}
 
-	// Write the decompressed data to the output file
-	std::ofstream outfile(output_filename);
-	if (!outfile.is_open())
+	// Read the dictionary stored in front of the encoded data
+	StageTimer tree_timer(stat_field(stats, &CompressionStats::tree_ns));
+	CodeTable codes{};
+	size_t data_start;
+	if (canonical)
 	{
-		std::cerr << "ERROR CREATING OUTPUT FILE.\n";
-		return;
+		CodeLengths lengths;
+		data_start = read_code_lengths(input.data() + header_size, input.size() - header_size, lengths);
+		if (data_start == 0 || !build_canonical_codes(lengths, codes))
+			return HuffmanStatus::DICTIONARY_READ_FAILED;
+		data_start += header_size;
+	}
+	else
+	{
+		std::ifstream infile(huffman_filename, std::ios::binary);
+		infile.seekg(static_cast<std::streamoff>(header_size));
+		if (!read_huffman_dictionary(infile, codes))
+			return HuffmanStatus::DICTIONARY_READ_FAILED;
+		data_start = static_cast<size_t>(infile.tellg());
 	}
+	const unsigned char *payload = input.data() + data_start;
+	const size_t payload_size = input.size() - data_start;
 
-	outfile << decoded_text;
-	outfile.close();
-	infile.close();
+	// Without a header every bit up to EOF counts; with one the last byte
+	// holds final_bits bits. Every symbol takes at least one bit.
+	long long encoded_length = static_cast<long long>(payload_size) * 8;
+	if (has_header && !interleaved)
+	{
+		if ((payload_size == 0) != (header.final_bits == 0))
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
+		if (payload_size > 0)
+			encoded_length -= 8 - header.final_bits;
+	}
+	if (has_header && header.original_size > static_cast<uint64_t>(encoded_length))
+		return HuffmanStatus::HUFFMAN_READ_FAILED;
+
+	DecodeTable table;
+	const bool table_ok = build_decode_table(codes, table);
+	tree_timer.stop();
+	if (stats != nullptr)
+	{
+		int distinct = 0, longest = 0;
+		for (const Codeword &code : codes)
+		{
+			distinct += code.length != 0;
+			longest = std::max<int>(longest, code.length);
+		}
+		stats->distinct_symbols = std::max(stats->distinct_symbols, distinct);
+		stats->max_code_length = std::max(stats->max_code_length, longest);
+	}
+
+	if (!has_header)
+	{
+		// Decode with the lookup tables, or walk the tree when the codes are too long for them
+		StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+		std::string decoded_text;
+		if (table_ok)
+		{
+			decoded_text = decode_data_table(payload, payload_size, table, encoded_length);
+		}
+		else
+		{
+			std::ifstream infile(huffman_filename, std::ios::binary);
+			infile.seekg(static_cast<std::streamoff>(data_start));
+			std::shared_ptr<Node> root = std::make_shared<Node>('+', 0);
+			build_tree_from_codes(codes, root);
+			decoded_text = decode_data(infile, root, encoded_length);
+		}
+		input.close();
+		code_timer.stop();
+
+		// Write the decompressed data to the output file
+		StageTimer io_timer(stat_field(stats, &CompressionStats::io_ns));
+		std::ofstream outfile(output_filename, std::ios::binary);
+		if (!outfile.is_open())
+			return HuffmanStatus::OUTPUT_CREATE_FAILED;
+
+		outfile.write(decoded_text.data(), static_cast<std::streamsize>(decoded_text.size()));
+		outfile.close();
+		if (!outfile)
+			return HuffmanStatus::OUTPUT_WRITE_FAILED;
+		io_timer.stop();
+		count_file(decoded_text.size());
+
+		return HuffmanStatus::OK;
+	}
+
+	// The original size is known, decode exactly that many symbols into the pre-sized output
+	const size_t size = static_cast<size_t>(header.original_size);
+	MappedOutput output;
+	if (!output.create(output_filename, size))
+		return HuffmanStatus::OUTPUT_CREATE_FAILED;
+
+	StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+	size_t decoded = 0;
+	if (table_ok)
+	{
+		decoded = interleaved ? decode_symbols_interleaved(payload, payload_size, table, output.data(), size)
+							  : decode_symbols(payload, payload_size, table, output.data(), size);
+	}
+	else if (!interleaved)
+	{
+		// Codes too long for the tables walk the flat tree, straight into the output
+		DecodeTree tree;
+		if (build_decode_tree(codes, tree))
+			decoded = decode_symbols_tree(payload, static_cast<size_t>((encoded_length + 7) / 8), tree, output.data(), size);
+	}
+	code_timer.stop();
+
+	StageTimer io_timer(stat_field(stats, &CompressionStats::io_ns));
+	if (decoded != size || crc32c(output.data(), size) != header.checksum)
+		return HuffmanStatus::HUFFMAN_READ_FAILED;
+	if (!output.commit())
+		return HuffmanStatus::OUTPUT_WRITE_FAILED;
+	io_timer.stop();
+	count_file(size);
 
-	std::cout << "File decompressed successfully.\n";
+	return HuffmanStatus::OK;
 }
@@ -6,8 +6,8 @@
 #ifndef HUFFMAN_COMPRESSION_H
 #define HUFFMAN_COMPRESSION_H
 
-#include <iostream>
 #include <fstream>
+#include <iosfwd>
 #include <memory>
 #include <unordered_map>
 #include <queue>
@@ -16,8 +16,36 @@
 #include <bitset>
 #include <array>
 #include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
 
-// Node class for the Huffman Tree
+#include "huffman_stats.h"
+
+constexpr int NUM_CHAR = 256; // 256 possible characters
+
+// Number of bitstreams symbols are dealt over in interleaved mode
+constexpr int INTERLEAVED_STREAMS = 4;
+
+// Default bound on the code length, keeps every code within a 16-bit window
+constexpr int DEFAULT_MAX_CODE_LENGTH = 15;
+
+// Bytes of one counted run of sample_frequency, and the fewest runs a
+// sample is made of; smaller inputs are counted in full
+constexpr size_t SAMPLE_RUN_SIZE = 4096;
+constexpr size_t SAMPLE_MIN_RUNS = 8;
+
+// Suggested CompressionOptions::sample_step, 1/16 of the data
+constexpr unsigned DEFAULT_SAMPLE_STEP = 16;
+
+// Width of the primary index of the table decoder
+constexpr int DECODE_TABLE_BITS = 11;
+
+// Longest code the table decoder accepts, longer codes use the tree walk
+constexpr int MAX_TABLE_CODE_LENGTH = 24;
+
+// Node class for the Huffman Tree. The encoder builds its codes on a flat
+// FlatNode array; this pointer tree is only a debug and reference view.
 class Node
 {
 public:
@@ -38,35 +66,387 @@ public:
     };
 };
 
+// Huffman code of one symbol, right-aligned in bits and read MSB first
+struct Codeword
+{
+    uint64_t bits;
+    uint8_t length;
+};
+
+// Code of every symbol, unused symbols have length 0
+using CodeTable = std::array<Codeword, NUM_CHAR>;
+
+// Node of the allocation-free Huffman tree. Leaves come first in the node
+// array, sorted by frequency, followed by the internal nodes in merge order.
+struct FlatNode
+{
+    uint64_t frequency;
+    uint16_t parent; // Index of the parent node, unused for the root
+};
+
+// Code length of every symbol, unused symbols have length 0
+using CodeLengths = std::array<uint8_t, NUM_CHAR>;
+
+// Decoding tree of codes too long for the decode tables, in one flat array
+// instead of allocated nodes. Node 0 is the root; a child is the index of
+// the next node, DECODE_TREE_LEAF | symbol for a leaf, or 0 when no code
+// takes that branch. A prefix code of NUM_CHAR symbols has at most
+// NUM_CHAR - 1 internal nodes, so the array never grows past that.
+constexpr uint16_t DECODE_TREE_LEAF = 0x8000;
+
+struct DecodeTree
+{
+    std::vector<std::array<uint16_t, 2>> nodes;
+};
+
+// Container header of a Huffman file, see huffman_format.h
+struct FileHeader;
+
+// Options selecting the layout of the compressed file, and what to report
+struct CompressionOptions
+{
+    bool canonical = true;                         // Store only the code lengths and rebuild canonical codes from them
+    int max_code_length = DEFAULT_MAX_CODE_LENGTH; // Longest code the encoder may emit, 0 for no limit (blocks stop at MAX_TABLE_CODE_LENGTH)
+    size_t block_size = 0;                         // Code the input as independent blocks of this size, 0 for one table over all of it
+    unsigned threads = 0;                          // Worker threads in block mode, 0 for one per hardware thread
+    uint32_t sync_interval = 0;                    // Record a restart bit offset every this many symbols of a block, 0 for none
+    bool interleaved = false;                      // Deal the symbols of each block over INTERLEAVED_STREAMS bitstreams (no sync points)
+    bool reuse_tables = false;                     // Let a block repeat the previous block's code table when that costs about as little
+    bool order1 = false;                           // Let a block code each byte with a table picked by the byte before it when that is smaller
+    bool byte_pairs = false;                       // Give frequent byte pairs symbols of their own when that is smaller (single table files)
+    bool pipeline = false;                         // Read, code and write blocks in overlapping stages (compress_path, block mode)
+    unsigned sample_step = 0;                      // Build codes from 1 run of every this many, see sample_frequency; 0 or 1 counts everything
+    CompressionStats *stats = nullptr;             // Counters and stage times to add to, nullptr to collect none
+    ProgressCallback progress;                     // Called with the bytes done after every block, empty for none
+};
+
+// Outcome of the file functions, which never print; status_message gives
+// the text to report
+enum class HuffmanStatus
+{
+    OK,
+    INPUT_OPEN_FAILED,      // The input file cannot be opened or mapped
+    INPUT_READ_FAILED,      // Reading the input failed or it got shorter
+    HUFFMAN_OPEN_FAILED,    // The Huffman file cannot be opened or mapped
+    HUFFMAN_CREATE_FAILED,
+    HUFFMAN_WRITE_FAILED,
+    HUFFMAN_READ_FAILED,    // The Huffman file is truncated, malformed or fails its checksum
+    DICTIONARY_READ_FAILED, // The stored code table is malformed
+    DICTIONARY_MISSING,     // The file was coded with a shared dictionary, see HuffmanDecoder
+    UNSUPPORTED_FORMAT,     // The container header is of a newer version or has unknown flags
+    OUTPUT_CREATE_FAILED,
+    OUTPUT_WRITE_FAILED,
+};
+
+// Function to give the message of a status, such as "ERROR READING HUFFMAN FILE."
+const char *status_message(HuffmanStatus status);
+
+// Packs codewords MSB first through a 64-bit accumulator, appending whole
+// 32-bit words to the output and the trailing bits on flush()
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<unsigned char> &out) : out(out), accumulator(0), filled(0), total(0) {}
+
+    void put(uint64_t bits, int length)
+    {
+        if (length > 32)
+        {
+            put(bits >> 32, length - 32);
+            bits &= 0xFFFFFFFFu;
+            length = 32;
+        }
+        if (length == 0)
+            return;
+
+        accumulator |= bits << (64 - filled - length);
+        filled += length;
+        total += length;
+        if (filled >= 32)
+        {
+            unsigned char word[4] = {static_cast<unsigned char>(accumulator >> 56), static_cast<unsigned char>(accumulator >> 48),
+                                     static_cast<unsigned char>(accumulator >> 40), static_cast<unsigned char>(accumulator >> 32)};
+            out.insert(out.end(), word, word + 4);
+            accumulator <<= 32;
+            filled -= 32;
+        }
+    }
+
+    // Write the remaining bits, zero padding the last byte
+    void flush()
+    {
+        while (filled > 0)
+        {
+            out.push_back(static_cast<unsigned char>(accumulator >> 56));
+            accumulator <<= 8;
+            filled = filled > 8 ? filled - 8 : 0;
+        }
+    }
+
+    // Number of bits written so far
+    uint64_t bit_count() const { return total; }
+
+private:
+    std::vector<unsigned char> &out;
+    uint64_t accumulator; // Pending bits, left-aligned
+    int filled;           // Pending bits in the accumulator
+    uint64_t total;
+};
+
+// Function to append a 32-bit value in little-endian order
+inline void write_le32(std::vector<unsigned char> &out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+}
+
+// Function to read a 32-bit little-endian value
+inline uint32_t read_le32(const unsigned char *data)
+{
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// Function to append a 64-bit value in little-endian order
+inline void write_le64(std::vector<unsigned char> &out, uint64_t value)
+{
+    write_le32(out, static_cast<uint32_t>(value));
+    write_le32(out, static_cast<uint32_t>(value >> 32));
+}
+
+// Function to read a 64-bit little-endian value
+inline uint64_t read_le64(const unsigned char *data)
+{
+    return static_cast<uint64_t>(read_le32(data)) | (static_cast<uint64_t>(read_le32(data + 4)) << 32);
+}
+
+// Entry of the table decoder. Primary entries are indexed by the next
+// DECODE_TABLE_BITS bits of the stream; codes longer than that link to a
+// subtable indexed by the following sub_bits bits.
+struct DecodeEntry
+{
+    uint32_t value;      // Symbol (low 16 bits) and paired symbol (high 16 bits), or subtable offset for links
+    uint8_t length;      // Bits taken by the first symbol, 0 for links and unused slots
+    uint8_t pair_length; // Bits taken by both symbols, 0 when the entry holds a single symbol
+    uint8_t sub_bits;    // Index width of the linked subtable, 0 for symbol entries
+};
+
+// Lookup tables built from a Huffman dictionary
+struct DecodeTable
+{
+    std::vector<DecodeEntry> entries; // Primary table followed by the subtables
+    int max_length = 0;               // Longest code in the dictionary
+
+    // Function to find the entry for the code at the top of window, the next
+    // 64 bits of the stream
+    const DecodeEntry &lookup(uint64_t window) const
+    {
+        const DecodeEntry &entry = entries[window >> (64 - DECODE_TABLE_BITS)];
+        if (entry.sub_bits == 0)
+            return entry;
+        return entries[entry.value + ((window << DECODE_TABLE_BITS) >> (64 - entry.sub_bits))];
+    }
+};
+
+// Reads a packed stream MSB first through a 64-bit window. Refills load eight
+// bytes at once while they are available; past the end zeros are shifted in
+// and available() tells how many of the window's bits are real.
+class BitReader
+{
+public:
+    BitReader(const unsigned char *data, size_t size, int skip_bits = 0) : next(data), end(data + size), window(0), filled(0)
+    {
+        if (skip_bits > 0 && next < end)
+        {
+            window = static_cast<uint64_t>(*next++) << (56 + skip_bits);
+            filled = 8 - skip_bits;
+        }
+    }
+
+    // Function to top the window up to at least 56 bits while data remains
+    void refill()
+    {
+        if (end - next >= 8)
+        {
+            uint64_t word = 0;
+            for (int i = 0; i < 8; ++i)
+                word = (word << 8) | next[i];
+            window |= word >> filled;
+            int bytes = (63 - filled) >> 3;
+            next += bytes;
+            filled += 8 * bytes;
+            return;
+        }
+        while (filled <= 56 && next < end)
+        {
+            window |= static_cast<uint64_t>(*next++) << (56 - filled);
+            filled += 8;
+        }
+    }
+
+    uint64_t bits() const { return window; }
+    int available() const { return filled; }
+
+    // Whether the next refill still loads a whole word, so at least 56 bits
+    // of the window are real afterwards
+    bool has_word() const { return end - next >= 8; }
+
+    void consume(int length)
+    {
+        window <<= length;
+        filled -= length;
+    }
+
+private:
+    const unsigned char *next;
+    const unsigned char *end;
+    uint64_t window; // Next bits of the stream, left-aligned
+    int filled;      // Bits of window that come from the data
+};
+
 // Function prototypes
 
-// Function to build the frequency table from the input text
-std::unordered_map<unsigned char, int> build_frequency_table(const std::string &text);
+// Function to initialize the frequency table
+void init_frequency(std::array<unsigned int, NUM_CHAR> &frequency);
+
+// Function to fill the frequency table based on the input text
+void fill_frequency(const std::string &text, std::array<unsigned int, NUM_CHAR> &frequency);
+
+// Function to fill the frequency table based on a block of bytes
+void fill_frequency(const unsigned char *data, size_t size, std::array<unsigned int, NUM_CHAR> &frequency);
+
+// Function to add an estimate of the byte frequencies of data[0, size) to
+// the table, counting one SAMPLE_RUN_SIZE run out of every step and scaling
+// up to the whole size. Every byte value gets a count of at least 1, so a
+// code built from the estimate covers bytes the sample missed. Inputs of
+// fewer than SAMPLE_MIN_RUNS runs, a step of 0 or 1, and samples of a single
+// byte value (which may be an RLE block) are counted in full.
+void sample_frequency(const unsigned char *data, size_t size, unsigned step, std::array<unsigned int, NUM_CHAR> &frequency);
+
+// Function to print the frequency table to out (for debugging purposes)
+void print_frequency(const std::array<unsigned int, NUM_CHAR> &frequency, std::ostream &out);
+
+// Function to build the Huffman Tree from the frequency table (debug view),
+// nullptr when every frequency is 0
+std::shared_ptr<Node> build_huffman_tree(const std::array<unsigned int, NUM_CHAR> &frequency);
+
+// Function to compute the Huffman code lengths on a flat node array with the
+// two-queue merge, without heap allocation
+void build_huffman_code_lengths(const std::array<unsigned int, NUM_CHAR> &frequency, CodeLengths &lengths);
+
+// Function to compute the Huffman code lengths, rebuilt under max_code_length
+// (when non-zero) if the plain tree is deeper than that
+void build_code_lengths(const std::array<unsigned int, NUM_CHAR> &frequency, int max_code_length, CodeLengths &lengths);
+
+// Function to build code lengths no longer than max_code_length with the
+// package-merge algorithm, returns false when the symbols do not fit
+bool build_length_limited_code_lengths(const std::array<unsigned int, NUM_CHAR> &frequency, int max_code_length, CodeLengths &lengths);
+
+// Function to generate the Huffman dictionary from the Huffman Tree
+void generate_dictionary(const std::shared_ptr<Node> &root, std::string code, std::array<std::string, NUM_CHAR> &dict);
+
+// Function to generate the packed Huffman codes from the Huffman Tree
+void generate_codes(const std::shared_ptr<Node> &root, uint64_t bits, int length, CodeTable &codes);
+
+// Function to extract the code length of every symbol
+void get_code_lengths(const CodeTable &codes, CodeLengths &lengths);
+
+// Function to assign canonical codes from the code lengths, returns false
+// when the lengths do not describe a prefix code
+bool build_canonical_codes(const CodeLengths &lengths, CodeTable &codes);
+
+// Function to append the run-length coded code lengths to the output
+void write_code_lengths(std::vector<unsigned char> &out, const CodeLengths &lengths);
+
+// Function to parse the run-length coded code lengths, returns the number of
+// bytes consumed or 0 when the data is malformed
+size_t read_code_lengths(const unsigned char *data, size_t size, CodeLengths &lengths);
+
+// Function to compute the size in bits of the text encoded with the given codes
+uint64_t encoded_bit_length(const std::array<unsigned int, NUM_CHAR> &frequency, const CodeTable &codes);
+
+// Function to print the generated dictionary to out (for debugging)
+void print_dictionary(const std::array<std::string, NUM_CHAR> &dict, std::ostream &out);
+
+// Function to encode the input text using the Huffman dictionary
+std::string encode_text(const std::string &text, const std::array<std::string, NUM_CHAR> &dict);
+
+// Function to encode the input text straight into packed bits, returns the number of bits written
+uint64_t encode_data(const std::string &text, const CodeTable &codes, std::vector<unsigned char> &packed);
+
+// Function to encode a block of bytes straight into packed bits, returns the number of bits written
+uint64_t encode_data(const unsigned char *data, size_t size, const CodeTable &codes, std::vector<unsigned char> &packed);
+
+// Function to write the Huffman dictionary into the compressed file
+void write_huffman_dictionary(std::ofstream &outfile, const CodeTable &codes);
+
+// Function to write the Huffman dictionary and encoded data into a binary file
+HuffmanStatus write_compressed_file(const std::string &huffman_name, const std::array<std::string, NUM_CHAR> &dict, const std::string &encoded_text);
+
+// Function to write the container header, the Huffman dictionary (or only the
+// code lengths when the header has FILE_FLAG_CANONICAL) and packed data into
+// a binary file; the size of the file goes to file_size when given
+HuffmanStatus write_compressed_file(const std::string &huffman_name, const FileHeader &header, const CodeTable &codes, const std::vector<unsigned char> &packed,
+                                    uint64_t *file_size = nullptr);
+
+// Function to compress a dataset into a Huffman file
+HuffmanStatus compress_file(const std::string &dataset, const std::string &huffman_name, const CompressionOptions &options = CompressionOptions());
+
+// Function to compress data[0, size) into a Huffman file
+HuffmanStatus compress_data(const unsigned char *data, size_t size, const std::string &huffman_name, const CompressionOptions &options = CompressionOptions());
+
+// Function to read the Huffman dictionary from the compressed file, returns
+// false when the file ends early or a stored code is empty or does not fit
+// in a Codeword
+bool read_huffman_dictionary(std::ifstream &infile, CodeTable &codes);
+
+// Function to rebuild the Huffman tree from the codes (reference decoder)
+void build_tree_from_codes(const CodeTable &codes, std::shared_ptr<Node> &root);
+
+// Function to build the decode lookup tables from the codes, returns false
+// when a code is longer than MAX_TABLE_CODE_LENGTH
+bool build_decode_table(const CodeTable &codes, DecodeTable &table);
+
+// Function to build the flat decoding tree of the codes, reusing the node
+// array of tree; returns false when the codes are not a prefix code
+bool build_decode_tree(const CodeTable &codes, DecodeTree &tree);
 
-// Function to build the Huffman Tree from the frequency table
-std::shared_ptr<Node> build_huffman_tree(const std::unordered_map<unsigned char, int> &frequency_table);
+// Function to decode exactly count symbols of packed data into out by
+// walking the flat tree, returns the number of symbols decoded (less than
+// count when the data is truncated or holds an invalid code)
+size_t decode_symbols_tree(const unsigned char *data, size_t size, const DecodeTree &tree, unsigned char *out, size_t count);
 
-// Function to build the Huffman codes from the Huffman Tree
-void build_huffman_codes(const std::shared_ptr<Node> &root, const std::string &code,
-                         std::unordered_map<unsigned char, std::string> &huffman_codes);
+// Function to decode the first encoded_length bits of packed data using the
+// Huffman tree (reference decoder); decoding stops early at the end of the
+// data or at a bit no code takes
+std::string decode_data(const unsigned char *data, size_t size, const std::shared_ptr<Node> &root, long long encoded_length);
 
-// Function to compress a file using Huffman encoding
-void compress_file(const std::string &input_filename, const std::string &output_filename);
+// Function to decode the binary data using the Huffman tree (reference decoder)
+std::string decode_data(std::ifstream &infile, std::shared_ptr<Node> &root, long long encoded_length);
 
-// Helper function to write Huffman dictionary to the file
-void write_huffman_dictionary(std::ofstream &outfile, const std::unordered_map<unsigned char, std::string> &huffman_codes);
+// Function to decode bit_count bits of packed data using the lookup tables
+std::string decode_data_table(const unsigned char *data, size_t size, const DecodeTable &table, long long bit_count);
 
-// Helper function to encode the text using the Huffman codes
-std::string encode_text(const std::string &text, const std::unordered_map<unsigned char, std::string> &huffman_codes);
+// Function to decode exactly count symbols of packed data into out using the
+// lookup tables, returns the number of symbols decoded (less than count when
+// the data is truncated or holds an invalid code). Decoding starts skip_bits
+// (0 to 7) bits into the first byte.
+size_t decode_symbols(const unsigned char *data, size_t size, const DecodeTable &table, unsigned char *out, size_t count, int skip_bits = 0);
 
-// Function to decompress a file using Huffman encoding
-void decompress_file(const std::string &huffman_filename, const std::string &output_filename);
+// Function to encode a block of bytes round-robin into INTERLEAVED_STREAMS
+// packed bitstreams: a jump table with the byte size of every stream but the
+// last (uint32 each), followed by the streams
+void encode_data_interleaved(const unsigned char *data, size_t size, const CodeTable &codes, std::vector<unsigned char> &out);
 
-// Helper function to read Huffman dictionary from the compressed file
-void read_huffman_dictionary(std::ifstream &infile, std::shared_ptr<Node> &root);
+// Function to decode exactly count symbols written by encode_data_interleaved,
+// advancing all streams in the same loop, returns the number of symbols
+// decoded (less than count when the data is malformed)
+size_t decode_symbols_interleaved(const unsigned char *data, size_t size, const DecodeTable &table, unsigned char *out, size_t count);
 
-// Helper function to decode the binary data using the Huffman tree
-std::string decode_data(std::ifstream &infile, std::shared_ptr<Node> &root, int encoded_length);
+// Function to decompress a Huffman file. Files with a container header are
+// decoded as the header says; headerless files (older versions, raw block
+// streams) must be read with the options they were written with.
+HuffmanStatus decompress_file(const std::string &huffman_filename, const std::string &output_filename, const CompressionOptions &options = CompressionOptions());
 
 
 #endif // HUFFMAN_COMPRESSION_H
\ No newline at end of file
@@ -0,0 +1,250 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_context.h"
+#include "huffman_pairs.h"
+
+HuffmanEncoder::HuffmanEncoder(const CompressionOptions &options) : options(options), have_codes(false), dictionary(nullptr)
+{
+	// The decoder tables read codes of up to MAX_TABLE_CODE_LENGTH bits
+	max_code_length = options.max_code_length > 0 ? std::min(options.max_code_length, MAX_TABLE_CODE_LENGTH) : MAX_TABLE_CODE_LENGTH;
+}
+
+// Function to forget the cached codes
+void HuffmanEncoder::reset()
+{
+	have_codes = false;
+	scratch.clear();
+	scratch.shrink_to_fit();
+}
+
+// Function to switch to (or away from) a shared dictionary
+void HuffmanEncoder::use_dictionary(const HuffmanDictionary *dictionary)
+{
+	this->dictionary = dictionary;
+}
+
+// Function to bound the size of a message
+size_t HuffmanEncoder::max_compressed_size(size_t in_size) const
+{
+	int longest = max_code_length;
+	if (dictionary != nullptr)
+		longest = *std::max_element(dictionary->lengths.begin(), dictionary->lengths.end());
+	return FILE_HEADER_SIZE + 2 * NUM_CHAR + (in_size * static_cast<size_t>(longest) + 7) / 8;
+}
+
+// Function to count one message of in_size bytes coded into out_size bytes
+static void count_message(CompressionStats &stats, size_t in_size, size_t out_size)
+{
+	stats.bytes_in += in_size;
+	stats.bytes_out += out_size;
+	stats.symbols += in_size;
+}
+
+// Function to compress one message
+size_t HuffmanEncoder::compress(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_capacity)
+{
+	if (dictionary != nullptr)
+		return compress_with_dictionary(in, in_size, out, out_capacity);
+
+	CompressionStats *stats = options.stats;
+	StageTimer histogram_timer(stat_field(stats, &CompressionStats::histogram_ns));
+	init_frequency(frequency);
+	sample_frequency(in, in_size, options.sample_step, frequency);
+	histogram_timer.stop();
+
+	StageTimer tree_timer(stat_field(stats, &CompressionStats::tree_ns));
+	build_code_lengths(frequency, max_code_length, lengths);
+
+	// Consecutive messages with the same statistics keep their codes
+	if (!have_codes || lengths != cached_lengths)
+	{
+		build_canonical_codes(lengths, codes);
+		cached_lengths = lengths;
+		have_codes = true;
+	}
+	tree_timer.stop();
+
+	FileHeader header;
+	header.flags = FILE_FLAG_CANONICAL;
+	header.original_size = in_size;
+	StageTimer checksum_timer(stat_field(stats, &CompressionStats::io_ns));
+	header.checksum = crc32c(in, in_size);
+	checksum_timer.stop();
+
+	// The scratch keeps its capacity, so this only allocates for a new largest message
+	StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+	scratch.clear();
+	scratch.reserve(max_compressed_size(in_size));
+	write_file_header(scratch, header);
+	write_code_lengths(scratch, lengths);
+	uint64_t bit_count = encode_data(in, in_size, codes, scratch);
+	scratch[6] = static_cast<unsigned char>(bit_count == 0 ? 0 : (bit_count - 1) % 8 + 1); // final_bits
+	code_timer.stop();
+
+	if (scratch.size() > out_capacity)
+		return 0;
+	std::memcpy(out, scratch.data(), scratch.size());
+	if (stats != nullptr)
+	{
+		count_message(*stats, in_size, scratch.size());
+		stats->distinct_symbols = std::max<int>(stats->distinct_symbols, static_cast<int>(std::count_if(lengths.begin(), lengths.end(), [](uint8_t length)
+																									   { return length != 0; })));
+		stats->max_code_length = std::max<int>(stats->max_code_length, *std::max_element(lengths.begin(), lengths.end()));
+	}
+	return scratch.size();
+}
+
+// Function to compress one message with the shared dictionary, only packing bits
+size_t HuffmanEncoder::compress_with_dictionary(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_capacity)
+{
+	FileHeader header;
+	header.flags = FILE_FLAG_CANONICAL | FILE_FLAG_DICTIONARY;
+	header.original_size = in_size;
+	StageTimer checksum_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	header.checksum = crc32c(in, in_size);
+	checksum_timer.stop();
+
+	StageTimer code_timer(stat_field(options.stats, &CompressionStats::code_ns));
+	scratch.clear();
+	scratch.reserve(max_compressed_size(in_size));
+	write_file_header(scratch, header);
+	write_le32(scratch, dictionary->id);
+	uint64_t bit_count = encode_data(in, in_size, dictionary->codes, scratch);
+	scratch[6] = static_cast<unsigned char>(bit_count == 0 ? 0 : (bit_count - 1) % 8 + 1); // final_bits
+	code_timer.stop();
+
+	if (scratch.size() > out_capacity)
+		return 0;
+	std::memcpy(out, scratch.data(), scratch.size());
+	if (options.stats != nullptr)
+		count_message(*options.stats, in_size, scratch.size());
+	return scratch.size();
+}
+
+HuffmanDecoder::HuffmanDecoder() : have_table(false), stats(nullptr)
+{
+}
+
+// Function to set where decompress() counts its messages
+void HuffmanDecoder::collect_stats(CompressionStats *stats)
+{
+	this->stats = stats;
+}
+
+// Function to forget the cached decode table
+void HuffmanDecoder::reset()
+{
+	have_table = false;
+	table.entries.clear();
+	table.entries.shrink_to_fit();
+}
+
+// Function to register a shared dictionary
+void HuffmanDecoder::add_dictionary(const HuffmanDictionary *dictionary)
+{
+	for (const HuffmanDictionary *&known : dictionaries)
+	{
+		if (known->id == dictionary->id)
+		{
+			known = dictionary;
+			return;
+		}
+	}
+	dictionaries.push_back(dictionary);
+}
+
+// Function to read the original size from the container header
+bool HuffmanDecoder::original_size(const unsigned char *in, size_t in_size, uint64_t &size)
+{
+	FileHeader header;
+	if (read_file_header(in, in_size, header) != HeaderStatus::OK)
+		return false;
+
+	size = header.original_size;
+	return true;
+}
+
+// Function to decompress one message
+bool HuffmanDecoder::decompress(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_capacity, size_t &out_size)
+{
+	out_size = 0;
+	FileHeader header;
+	if (read_file_header(in, in_size, header) != HeaderStatus::OK || (header.flags & (FILE_FLAG_BLOCKED | FILE_FLAG_CANONICAL)) != FILE_FLAG_CANONICAL ||
+		header.original_size > out_capacity)
+		return false;
+
+	const size_t size = static_cast<size_t>(header.original_size);
+	if (size == 0)
+		return header.checksum == crc32c(in, 0);
+
+	if (header.flags & FILE_FLAG_BYTE_PAIRS)
+	{
+		// Messages coded over the byte-pair alphabet carry their own pair table
+		StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+		if (!decode_byte_pairs(in + FILE_HEADER_SIZE, in_size - FILE_HEADER_SIZE, out, size))
+			return false;
+		code_timer.stop();
+		StageTimer checksum_timer(stat_field(stats, &CompressionStats::io_ns));
+		if (crc32c(out, size) != header.checksum)
+			return false;
+		checksum_timer.stop();
+		if (stats != nullptr)
+			count_message(*stats, in_size, size);
+		out_size = size;
+		return true;
+	}
+
+	StageTimer tree_timer(stat_field(stats, &CompressionStats::tree_ns));
+	size_t consumed;
+	const DecodeTable *message_table = &table;
+	if (header.flags & FILE_FLAG_DICTIONARY)
+	{
+		// The shared dictionary brings its own prebuilt tables
+		if (in_size - FILE_HEADER_SIZE < 4)
+			return false;
+		uint32_t id = read_le32(in + FILE_HEADER_SIZE);
+		auto found = std::find_if(dictionaries.begin(), dictionaries.end(), [id](const HuffmanDictionary *dictionary)
+								  { return dictionary->id == id; });
+		if (found == dictionaries.end())
+			return false;
+		message_table = &(*found)->table;
+		consumed = 4;
+	}
+	else
+	{
+		consumed = read_code_lengths(in + FILE_HEADER_SIZE, in_size - FILE_HEADER_SIZE, lengths);
+		if (consumed == 0)
+			return false;
+
+		// Consecutive messages with the same code lengths keep the decode table
+		if (!have_table || lengths != cached_lengths)
+		{
+			have_table = false;
+			if (!build_canonical_codes(lengths, codes) || !build_decode_table(codes, table))
+				return false;
+			cached_lengths = lengths;
+			have_table = true;
+		}
+	}
+
+	tree_timer.stop();
+
+	StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+	const unsigned char *payload = in + FILE_HEADER_SIZE + consumed;
+	const size_t payload_size = in_size - FILE_HEADER_SIZE - consumed;
+	size_t decoded = (header.flags & FILE_FLAG_INTERLEAVED) ? decode_symbols_interleaved(payload, payload_size, *message_table, out, size)
+															: decode_symbols(payload, payload_size, *message_table, out, size);
+	code_timer.stop();
+	StageTimer checksum_timer(stat_field(stats, &CompressionStats::io_ns));
+	if (decoded != size || crc32c(out, size) != header.checksum)
+		return false;
+	checksum_timer.stop();
+
+	if (stats != nullptr)
+		count_message(*stats, in_size, size);
+	out_size = size;
+	return true;
+}
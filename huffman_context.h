@@ -0,0 +1,98 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_CONTEXT_H
+#define HUFFMAN_CONTEXT_H
+
+#include "huffman_dictionary.h"
+
+// Reusable in-memory compressor for many small messages. Every message is a
+// complete single table file (container header, code lengths, packed data)
+// that decompress_file can read as well. The frequency table, codes and
+// output scratch live in the object, so once the scratch has grown to the
+// largest message compress() does not allocate.
+//
+// Messages always store canonical code lengths in a single bitstream; codes
+// are limited to MAX_TABLE_CODE_LENGTH bits so HuffmanDecoder can use its
+// lookup tables. block_size, threads and interleaved are ignored. With a
+// shared dictionary the message only names it by id and compress() skips
+// the frequency count and code build. options.stats, when set, counts every
+// message compress() writes.
+class HuffmanEncoder
+{
+public:
+    explicit HuffmanEncoder(const CompressionOptions &options = CompressionOptions());
+
+    // Function to drop the cached codes and release the scratch buffer, the
+    // dictionary stays in use
+    void reset();
+
+    // Function to code every message with the prepared dictionary, which must
+    // outlive its use; nullptr goes back to a table per message
+    void use_dictionary(const HuffmanDictionary *dictionary);
+
+    // Function to compress in[0, in_size) into out, returns the bytes written
+    // or 0 when the message does not fit in out_capacity bytes
+    size_t compress(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_capacity);
+
+    // Function to give the largest message compress() can write for in_size bytes
+    size_t max_compressed_size(size_t in_size) const;
+
+private:
+    size_t compress_with_dictionary(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_capacity);
+
+    CompressionOptions options;
+    int max_code_length; // Effective code length limit
+    std::array<unsigned int, NUM_CHAR> frequency;
+    CodeLengths lengths;
+    CodeLengths cached_lengths; // Lengths the codes were built for
+    CodeTable codes;
+    bool have_codes;
+    std::vector<unsigned char> scratch; // Message being written
+    const HuffmanDictionary *dictionary;
+};
+
+// Reusable in-memory decompressor for messages written by HuffmanEncoder (or
+// single table files of compress_file with canonical codes). The decode table
+// is kept between messages and only rebuilt when the code lengths change, so
+// decompress() does not allocate once its table has grown. Messages naming a
+// dictionary are decoded with the prebuilt tables of the one added with
+// that id.
+class HuffmanDecoder
+{
+public:
+    HuffmanDecoder();
+
+    // Function to drop the cached decode table, added dictionaries stay
+    void reset();
+
+    // Function to make a prepared dictionary available to messages naming its
+    // id; it must outlive its use and replaces an earlier one with the same id
+    void add_dictionary(const HuffmanDictionary *dictionary);
+
+    // Function to read the original size of the message at in, returns false
+    // when it has no container header
+    static bool original_size(const unsigned char *in, size_t in_size, uint64_t &size);
+
+    // Function to decompress the message at in into out, returns false when
+    // the message is malformed, fails its checksum or does not fit in
+    // out_capacity bytes; out_size is set to the decoded size
+    bool decompress(const unsigned char *in, size_t in_size, unsigned char *out, size_t out_capacity, size_t &out_size);
+
+    // Function to add the counters and stage times of every decoded message
+    // to stats from now on, nullptr stops collecting
+    void collect_stats(CompressionStats *stats);
+
+private:
+    CodeLengths lengths;
+    CodeLengths cached_lengths; // Lengths the table was built for
+    CodeTable codes;
+    DecodeTable table;
+    bool have_table;
+    std::vector<const HuffmanDictionary *> dictionaries;
+    CompressionStats *stats;
+};
+
+#endif // HUFFMAN_CONTEXT_H
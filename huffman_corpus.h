@@ -0,0 +1,114 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_CORPUS_H
+#define HUFFMAN_CORPUS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// Generated inputs shared by the benchmarks and the tests, each the same for
+// a given size on every run
+
+// Size of every generated benchmark corpus
+constexpr size_t CORPUS_SIZE = size_t(4) << 20;
+
+// Function to generate English-like text: Zipf-distributed words built from
+// letters of English frequency, with punctuation and line breaks
+inline std::string make_text(size_t size)
+{
+    const char letters[] = "eeeeeeeeeeeetttttttttaaaaaaaaooooooooiiiiiiinnnnnnnsssssshhhhhhrrrrrrddddlllluuucccmmmwwffggyyppbbvk";
+    std::mt19937 random(1);
+    std::vector<std::string> words(4000);
+    for (std::string &word : words)
+    {
+        size_t length = 1 + random() % 4 + random() % 5;
+        for (size_t i = 0; i < length; ++i)
+            word += letters[random() % (sizeof(letters) - 1)];
+    }
+
+    // Cumulative Zipf weights of the vocabulary
+    std::vector<double> cumulative(words.size());
+    double total = 0;
+    for (size_t i = 0; i < words.size(); ++i)
+        cumulative[i] = total += 1.0 / (i + 1);
+
+    std::uniform_real_distribution<double> pick(0, total);
+    std::string text;
+    text.reserve(size + 16);
+    while (text.size() < size)
+    {
+        size_t k = std::lower_bound(cumulative.begin(), cumulative.end(), pick(random)) - cumulative.begin();
+        text += words[std::min(k, words.size() - 1)];
+        unsigned r = random() % 100;
+        text += r < 6 ? ", " : r < 10 ? ".\n" : " ";
+    }
+    text.resize(size);
+    return text;
+}
+
+// Function to generate binary records: counters, small type codes, flags,
+// zero padding and noisy measurement bytes
+inline std::string make_binary(size_t size)
+{
+    std::mt19937 random(2);
+    std::string data;
+    data.reserve(size + 16);
+    uint32_t counter = 0;
+    while (data.size() < size)
+    {
+        counter += 1 + random() % 4;
+        for (int i = 0; i < 4; ++i)
+            data += static_cast<char>(counter >> (8 * i));
+        data += static_cast<char>(random() % 8);
+        data += static_cast<char>((random() % 4) << 4);
+        data.append(4, '\0');
+        for (int i = 0; i < 6; ++i)
+            data += static_cast<char>(i < 3 ? random() : random() % 16);
+    }
+    data.resize(size);
+    return data;
+}
+
+// Function to generate low-entropy data: mostly zeros with a few other values
+inline std::string make_low_entropy(size_t size)
+{
+    std::mt19937 random(3);
+    std::string data(size, '\0');
+    for (char &c : data)
+    {
+        if (random() % 100 < 5)
+            c = static_cast<char>(1 + random() % 4);
+    }
+    return data;
+}
+
+// Function to generate skewed data: byte k about half as frequent as byte
+// k - 1, so the unlimited code runs longer than any length limit
+inline std::string make_skewed(size_t size)
+{
+    std::mt19937 random(5);
+    std::geometric_distribution<int> pick(0.5);
+    std::string data(size, '\0');
+    for (char &c : data)
+        c = static_cast<char>(std::min(pick(random), 255));
+    return data;
+}
+
+// Function to generate uniformly random bytes
+inline std::string make_random(size_t size)
+{
+    std::mt19937 random(4);
+    std::string data(size, '\0');
+    for (char &c : data)
+        c = static_cast<char>(random());
+    return data;
+}
+
+#endif // HUFFMAN_CORPUS_H
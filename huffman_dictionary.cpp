@@ -0,0 +1,99 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_dictionary.h"
+
+#include <climits>
+
+DictionaryTrainer::DictionaryTrainer() : totals{}, bytes(0)
+{
+}
+
+// Function to count the bytes of one sample
+void DictionaryTrainer::add(const unsigned char *data, size_t size)
+{
+	// Count in chunks the 32-bit frequency table cannot overflow on
+	constexpr size_t CHUNK_SIZE = size_t(1) << 30;
+	while (size > 0)
+	{
+		size_t chunk = std::min(size, CHUNK_SIZE);
+		std::array<unsigned int, NUM_CHAR> frequency;
+		init_frequency(frequency);
+		fill_frequency(data, chunk, frequency);
+		for (int i = 0; i < NUM_CHAR; ++i)
+			totals[i] += frequency[i];
+
+		bytes += chunk;
+		data += chunk;
+		size -= chunk;
+	}
+}
+
+void DictionaryTrainer::add(const std::string &sample)
+{
+	add(reinterpret_cast<const unsigned char *>(sample.data()), sample.size());
+}
+
+// Function to build the dictionary code from the corpus frequencies
+bool DictionaryTrainer::train(uint32_t id, HuffmanDictionary &dictionary, int max_code_length) const
+{
+	if (max_code_length < 8 || max_code_length > MAX_TABLE_CODE_LENGTH)
+		return false; // 256 codes need at least 8 bits
+
+	// Scale large corpora down to the 32-bit frequency table
+	uint64_t largest = *std::max_element(totals.begin(), totals.end());
+	int shift = 0;
+	while ((largest >> shift) >= UINT_MAX / 2)
+		++shift;
+
+	// Every byte gets a count, so messages may hold bytes the corpus never had
+	std::array<unsigned int, NUM_CHAR> frequency;
+	for (int i = 0; i < NUM_CHAR; ++i)
+		frequency[i] = static_cast<unsigned int>(totals[i] >> shift) + 1;
+
+	build_code_lengths(frequency, max_code_length, dictionary.lengths);
+	dictionary.id = id != 0 ? id : crc32c(dictionary.lengths.data(), dictionary.lengths.size());
+	return prepare_dictionary(dictionary);
+}
+
+// Function to build the tables of the dictionary
+bool prepare_dictionary(HuffmanDictionary &dictionary)
+{
+	// Messages may use any byte, so every symbol needs a code
+	if (std::find(dictionary.lengths.begin(), dictionary.lengths.end(), 0) != dictionary.lengths.end())
+		return false;
+
+	return build_canonical_codes(dictionary.lengths, dictionary.codes) && build_decode_table(dictionary.codes, dictionary.table);
+}
+
+// Function to serialize the dictionary
+void write_dictionary(std::vector<unsigned char> &out, const HuffmanDictionary &dictionary)
+{
+	size_t start = out.size();
+	write_le32(out, DICTIONARY_MAGIC);
+	out.push_back(DICTIONARY_VERSION);
+	write_le32(out, dictionary.id);
+	write_code_lengths(out, dictionary.lengths);
+	write_le32(out, crc32c(out.data() + start, out.size() - start));
+}
+
+// Function to load a serialized dictionary
+bool read_dictionary(const unsigned char *data, size_t size, HuffmanDictionary &dictionary)
+{
+	constexpr size_t FIXED_SIZE = 9; // Magic, version and id
+	if (size < FIXED_SIZE + 4 || read_le32(data) != DICTIONARY_MAGIC || data[4] < 1 || data[4] > DICTIONARY_VERSION)
+		return false;
+
+	size_t consumed = read_code_lengths(data + FIXED_SIZE, size - FIXED_SIZE - 4, dictionary.lengths);
+	if (consumed == 0)
+		return false;
+
+	size_t checked = FIXED_SIZE + consumed;
+	if (read_le32(data + checked) != crc32c(data, checked))
+		return false;
+
+	dictionary.id = read_le32(data + 5);
+	return prepare_dictionary(dictionary);
+}
@@ -0,0 +1,70 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_DICTIONARY_H
+#define HUFFMAN_DICTIONARY_H
+
+#include "huffman_format.h"
+
+// Marks a serialized dictionary ("AHDC")
+constexpr uint32_t DICTIONARY_MAGIC = 0x43444841;
+
+// Dictionary version written by this library, readers reject newer ones
+constexpr uint8_t DICTIONARY_VERSION = 1;
+
+// Serialized dictionary, little-endian:
+//   uint32 DICTIONARY_MAGIC
+//   uint8 version
+//   uint32 id
+//   code lengths  run-length coded, see write_code_lengths
+//   uint32 CRC32C of everything before it
+
+// Static code trained once over a sample corpus and shared by encoder and
+// decoder, so messages only name it by id instead of carrying a table. Every
+// byte value has a code, whether or not the corpus contained it.
+struct HuffmanDictionary
+{
+    uint32_t id = 0;
+    CodeLengths lengths{};
+    CodeTable codes{}; // Canonical codes built from lengths
+    DecodeTable table; // Decode tables built from codes
+};
+
+// Collects byte frequencies over the samples of a corpus with fill_frequency
+class DictionaryTrainer
+{
+public:
+    DictionaryTrainer();
+
+    // Function to add a sample to the corpus
+    void add(const unsigned char *data, size_t size);
+    void add(const std::string &sample);
+
+    // Function to build a dictionary from the corpus, with codes no longer
+    // than max_code_length (at most MAX_TABLE_CODE_LENGTH). An id of 0 is
+    // replaced by the CRC32C of the code lengths.
+    bool train(uint32_t id, HuffmanDictionary &dictionary, int max_code_length = DEFAULT_MAX_CODE_LENGTH) const;
+
+    // Number of sample bytes added so far
+    uint64_t sample_bytes() const { return bytes; }
+
+private:
+    std::array<uint64_t, NUM_CHAR> totals;
+    uint64_t bytes;
+};
+
+// Function to build the codes and decode tables of a dictionary from its id
+// and code lengths, returns false when the lengths are not a complete prefix
+// code the table decoder can read
+bool prepare_dictionary(HuffmanDictionary &dictionary);
+
+// Function to append the serialized dictionary to out
+void write_dictionary(std::vector<unsigned char> &out, const HuffmanDictionary &dictionary);
+
+// Function to load a serialized dictionary and prepare its tables, returns
+// false when it is malformed or fails its checksum
+bool read_dictionary(const unsigned char *data, size_t size, HuffmanDictionary &dictionary);
+
+#endif // HUFFMAN_DICTIONARY_H
@@ -0,0 +1,333 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_EMBEDDED_H
+#define HUFFMAN_EMBEDDED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Embedded profile of the decoder, for microcontrollers (AVR, ESP32, ARM
+// Cortex-M) where the rest of the library does not fit. This header only
+// includes the C headers <stddef.h> and <stdint.h>. It does not use the heap,
+// the C++ standard library, exceptions or RTTI, so it builds with avr-gcc
+// and -fno-exceptions -fno-rtti.
+//
+// EmbeddedDecoder reads one Huffman file or HuffmanEncoder message from a
+// byte-source callback. It writes the decoded bytes to a sink callback
+// through a small output buffer, and it checks the length and checksum
+// from the container header. It decodes the single table, canonical
+// layouts: code lengths, or the id of a shared dictionary whose code
+// lengths were stored at build time. Block, interleaved and byte-pair
+// files are refused with EmbeddedStatus::UNSUPPORTED. So are files with
+// codes longer than the compile-time MaxCodeLength. To make a file the
+// profile can read:
+//
+//   CompressionOptions options;
+//   options.max_code_length = 12; // at most the decoder's MaxCodeLength
+//   compress_data(data, size, "firmware.huf", options);
+//
+// Symbols are decoded canonically, one bit at a time. Decoding compares
+// against the code counts of each length, so it needs no lookup table.
+// Decoding takes up to MaxCodeLength steps per byte, and memory stays at a
+// few hundred bytes.
+//
+// Footprint, for EmbeddedDecoder<MaxCodeLength, OutputSize>:
+//   RAM    NUM_CHAR (256) bytes of symbols in code order
+//          + 2 * (MaxCodeLength + 1) bytes of code counts
+//          + OutputSize bytes of output buffer
+//          + 24 bytes of state and callbacks (on AVR, where pointers are
+//          2 bytes).
+//          The defaults <15, 32> take about 344 bytes. The decoder keeps
+//          a 20-byte header on the stack while it parses it.
+//   Flash  the decode code, plus a 64-byte CRC32C nibble table. On AVR
+//          the table is kept in PROGMEM. Dictionary code lengths passed
+//          to use_dictionary are read through the same flash accessor.
+//
+// The container constants mirror huffman_format.h, huffman_format.cpp
+// checks that they agree.
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define HUFFMAN_EMBEDDED_FLASH PROGMEM
+#define HUFFMAN_EMBEDDED_READ_BYTE(address) pgm_read_byte(address)
+#define HUFFMAN_EMBEDDED_READ_WORD32(address) pgm_read_dword(address)
+#else
+#define HUFFMAN_EMBEDDED_FLASH
+#define HUFFMAN_EMBEDDED_READ_BYTE(address) (*(address))
+#define HUFFMAN_EMBEDDED_READ_WORD32(address) (*(address))
+#endif
+
+constexpr uint32_t EMBEDDED_FILE_MAGIC = 0x46554841; // "AHUF"
+constexpr uint8_t EMBEDDED_FILE_VERSION = 1;
+constexpr size_t EMBEDDED_FILE_HEADER_SIZE = 20;
+constexpr uint8_t EMBEDDED_FLAG_CANONICAL = 0x01;
+constexpr uint8_t EMBEDDED_FLAG_DICTIONARY = 0x08;
+constexpr int EMBEDDED_NUM_CHAR = 256;
+
+// Outcome of EmbeddedDecoder::decode
+enum class EmbeddedStatus : uint8_t
+{
+    OK,
+    TRUNCATED,          // The source ended inside the file
+    BAD_HEADER,         // No container header, or an unknown version
+    UNSUPPORTED,        // A layout, code length or size the profile does not decode
+    BAD_CODE_LENGTHS,   // The code lengths are malformed or not a prefix code
+    DICTIONARY_MISSING, // The file names a dictionary the decoder was not given
+    BAD_DATA,           // The bitstream holds a code no symbol has
+    CHECKSUM_MISMATCH,  // The decoded bytes fail the CRC32C of the header
+    SINK_FAILED         // The sink refused the output
+};
+
+// Gives the next byte of the compressed data (0 to 255), or -1 at its end
+typedef int (*EmbeddedByteSource)(void *context);
+
+// Takes size decoded bytes, returns false to stop decoding
+typedef bool (*EmbeddedByteSink)(void *context, const uint8_t *data, size_t size);
+
+// Function to continue the CRC32C (Castagnoli) of a byte stream, crc
+// starts at 0xFFFFFFFF and the final value is its complement; half a byte
+// per table lookup
+inline uint32_t embedded_crc32c_update(uint32_t crc, uint8_t byte)
+{
+    static const uint32_t table[16] HUFFMAN_EMBEDDED_FLASH = {
+        0x00000000, 0x105EC76F, 0x20BD8EDE, 0x30E349B1, 0x417B1DBC, 0x5125DAD3, 0x61C69362, 0x7198540D,
+        0x82F63B78, 0x92A8FC17, 0xA24BB5A6, 0xB21572C9, 0xC38D26C4, 0xD3D3E1AB, 0xE330A81A, 0xF36E6F75};
+    crc = (crc >> 4) ^ HUFFMAN_EMBEDDED_READ_WORD32(&table[(crc ^ byte) & 0x0F]);
+    crc = (crc >> 4) ^ HUFFMAN_EMBEDDED_READ_WORD32(&table[(crc ^ (byte >> 4)) & 0x0F]);
+    return crc;
+}
+
+template <int MaxCodeLength = 15, size_t OutputSize = 32>
+class EmbeddedDecoder
+{
+    static_assert(MaxCodeLength >= 1 && MaxCodeLength <= 16, "codes are 1 to 16 bits");
+    static_assert(OutputSize >= 1 && OutputSize <= 0xFFFF, "the output buffer index is 16 bits");
+
+public:
+    EmbeddedDecoder(EmbeddedByteSource source, EmbeddedByteSink sink, void *context)
+        : source(source), sink(sink), context(context), dictionary_id(0), dictionary_lengths(nullptr), used(0), bits(0), bit_count(0),
+          crc(0), produced(0)
+    {
+    }
+
+    // Function to let files naming id decode with the NUM_CHAR code lengths
+    // at lengths (in flash: PROGMEM on AVR), for example the lengths of a
+    // HuffmanDictionary written into the firmware; nullptr forgets it
+    void use_dictionary(uint32_t id, const uint8_t *lengths)
+    {
+        dictionary_id = id;
+        dictionary_lengths = lengths;
+    }
+
+    // Function to decode one file from the source into the sink. Reading
+    // stops right after the file's last byte, so files written back to back
+    // decode with one call each. The output is complete only when the
+    // result is OK.
+    EmbeddedStatus decode()
+    {
+        produced = 0;
+        used = 0;
+        bits = 0;
+        bit_count = 0;
+        crc = 0xFFFFFFFF;
+
+        uint8_t header[EMBEDDED_FILE_HEADER_SIZE];
+        for (size_t i = 0; i < EMBEDDED_FILE_HEADER_SIZE; ++i)
+        {
+            int byte = source(context);
+            if (byte < 0)
+                return EmbeddedStatus::TRUNCATED;
+            header[i] = static_cast<uint8_t>(byte);
+        }
+        if (read_le32(header) != EMBEDDED_FILE_MAGIC || header[4] < 1 || header[4] > EMBEDDED_FILE_VERSION)
+            return EmbeddedStatus::BAD_HEADER;
+
+        const uint8_t flags = header[5];
+        const uint32_t checksum = read_le32(header + 16);
+        if ((flags & EMBEDDED_FLAG_CANONICAL) == 0 || (flags & ~(EMBEDDED_FLAG_CANONICAL | EMBEDDED_FLAG_DICTIONARY)) != 0 ||
+            read_le32(header + 12) != 0)
+            return EmbeddedStatus::UNSUPPORTED;
+        const uint32_t size = read_le32(header + 8);
+
+        // Empty files still carry their code lengths (or dictionary id), but need no code
+        EmbeddedStatus status = (flags & EMBEDDED_FLAG_DICTIONARY) ? read_dictionary_id() : read_code_lengths();
+        if (size == 0 && (status == EmbeddedStatus::OK || status == EmbeddedStatus::DICTIONARY_MISSING))
+            return checksum == 0 ? EmbeddedStatus::OK : EmbeddedStatus::CHECKSUM_MISMATCH;
+        if (status != EmbeddedStatus::OK)
+            return status;
+
+        for (uint32_t remaining = size; remaining > 0; --remaining)
+        {
+            int symbol = decode_symbol();
+            if (symbol < 0)
+                return symbol == -1 ? EmbeddedStatus::TRUNCATED : EmbeddedStatus::BAD_DATA;
+            crc = embedded_crc32c_update(crc, static_cast<uint8_t>(symbol));
+            output[used++] = static_cast<uint8_t>(symbol);
+            if (used == OutputSize && !flush())
+                return EmbeddedStatus::SINK_FAILED;
+        }
+        if (used > 0 && !flush())
+            return EmbeddedStatus::SINK_FAILED;
+        return ~crc == checksum ? EmbeddedStatus::OK : EmbeddedStatus::CHECKSUM_MISMATCH;
+    }
+
+    // Bytes handed to the sink by the last decode()
+    uint32_t decoded_size() const { return produced; }
+
+private:
+    static uint32_t read_le32(const uint8_t *data)
+    {
+        return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) |
+               (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    bool flush()
+    {
+        produced += used;
+        bool ok = sink(context, output, used);
+        used = 0;
+        return ok;
+    }
+
+    // Function to start building the code tables
+    void clear_code()
+    {
+        for (int length = 0; length <= MaxCodeLength; ++length)
+            count[length] = 0;
+    }
+
+    // Function to add the next symbol (symbols come in increasing order) with
+    // a code of length bits. symbols[] stays sorted by length and then symbol,
+    // which is the order of the canonical codes, so the symbols of longer
+    // codes move up by one to make room.
+    void add_symbol(int symbol, int length)
+    {
+        size_t position = 0, total = 0;
+        for (int k = 1; k <= MaxCodeLength; ++k)
+        {
+            total += count[k];
+            if (k <= length)
+                position += count[k];
+        }
+        for (size_t k = total; k > position; --k)
+            symbols[k] = symbols[k - 1];
+        symbols[position] = static_cast<uint8_t>(symbol);
+        count[length]++;
+    }
+
+    // Function to check the code counts against the Kraft inequality, a
+    // lone symbol may leave the code incomplete
+    bool code_fits() const
+    {
+        int32_t available = 1;
+        for (int length = 1; length <= MaxCodeLength; ++length)
+        {
+            available = 2 * available - count[length];
+            if (available < 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Function to parse the code lengths written by write_code_lengths: a
+    // zero byte starts a run of unused symbols whose size minus one follows
+    EmbeddedStatus read_code_lengths()
+    {
+        clear_code();
+        for (int symbol = 0; symbol < EMBEDDED_NUM_CHAR;)
+        {
+            int length = source(context);
+            if (length < 0)
+                return EmbeddedStatus::TRUNCATED;
+            if (length == 0)
+            {
+                int run = source(context);
+                if (run < 0)
+                    return EmbeddedStatus::TRUNCATED;
+                symbol += run + 1;
+                if (symbol > EMBEDDED_NUM_CHAR)
+                    return EmbeddedStatus::BAD_CODE_LENGTHS;
+                continue;
+            }
+            if (length > MaxCodeLength)
+                return EmbeddedStatus::UNSUPPORTED;
+            add_symbol(symbol++, length);
+        }
+        return code_fits() ? EmbeddedStatus::OK : EmbeddedStatus::BAD_CODE_LENGTHS;
+    }
+
+    // Function to read the dictionary id and build the code of its lengths
+    EmbeddedStatus read_dictionary_id()
+    {
+        uint8_t id[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            int byte = source(context);
+            if (byte < 0)
+                return EmbeddedStatus::TRUNCATED;
+            id[i] = static_cast<uint8_t>(byte);
+        }
+        if (dictionary_lengths == nullptr || read_le32(id) != dictionary_id)
+            return EmbeddedStatus::DICTIONARY_MISSING;
+
+        clear_code();
+        for (int symbol = 0; symbol < EMBEDDED_NUM_CHAR; ++symbol)
+        {
+            uint8_t length = HUFFMAN_EMBEDDED_READ_BYTE(dictionary_lengths + symbol);
+            if (length > MaxCodeLength)
+                return EmbeddedStatus::UNSUPPORTED;
+            if (length != 0)
+                add_symbol(symbol, length);
+        }
+        return code_fits() ? EmbeddedStatus::OK : EmbeddedStatus::BAD_CODE_LENGTHS;
+    }
+
+    // Function to decode one symbol a bit at a time, MSB first: the codes of
+    // every length are consecutive, so a code is one of them when it is
+    // less than count[length] past the first. Returns -1 when the source
+    // ends and -2 for a code no symbol has.
+    int decode_symbol()
+    {
+        uint32_t code = 0;  // Bits read so far
+        uint32_t first = 0; // First code of the current length
+        size_t index = 0;   // Position in symbols[] of that code
+        for (int length = 1; length <= MaxCodeLength; ++length)
+        {
+            if (bit_count == 0)
+            {
+                int byte = source(context);
+                if (byte < 0)
+                    return -1;
+                bits = static_cast<uint8_t>(byte);
+                bit_count = 8;
+            }
+            code |= (bits >> --bit_count) & 1;
+            if (code - first < count[length])
+                return symbols[index + (code - first)];
+            index += count[length];
+            first = (first + count[length]) << 1;
+            code <<= 1;
+        }
+        return -2;
+    }
+
+    EmbeddedByteSource source;
+    EmbeddedByteSink sink;
+    void *context;
+    uint32_t dictionary_id;
+    const uint8_t *dictionary_lengths;
+
+    uint8_t symbols[EMBEDDED_NUM_CHAR];  // Used symbols in canonical code order
+    uint16_t count[MaxCodeLength + 1];   // Symbols with a code of each length
+    uint8_t output[OutputSize];          // Decoded bytes not yet given to the sink
+    uint16_t used;                       // Bytes in output
+    uint8_t bits;                        // Byte of the bitstream being read
+    uint8_t bit_count;                   // Bits of it not read yet
+    uint32_t crc;                        // CRC32C of the decoded bytes so far
+    uint32_t produced;                   // Bytes given to the sink
+};
+
+#endif // HUFFMAN_EMBEDDED_H
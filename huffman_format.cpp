@@ -0,0 +1,149 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_format.h"
+#include "huffman_embedded.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define HUFFMAN_CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HUFFMAN_CRC32C_ARM 1
+#endif
+
+// The embedded decoder keeps its own copy of the container constants
+static_assert(EMBEDDED_FILE_MAGIC == FILE_MAGIC && EMBEDDED_FILE_VERSION == FILE_VERSION && EMBEDDED_FILE_HEADER_SIZE == FILE_HEADER_SIZE,
+			  "huffman_embedded.h does not match the container header");
+static_assert(EMBEDDED_FLAG_CANONICAL == FILE_FLAG_CANONICAL && EMBEDDED_FLAG_DICTIONARY == FILE_FLAG_DICTIONARY && EMBEDDED_NUM_CHAR == NUM_CHAR,
+			  "huffman_embedded.h does not match the container flags");
+
+namespace
+{
+	// Reflected CRC32C polynomial
+	constexpr uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+	// Tables of the slicing-by-8 fallback, table[k][b] is the CRC of byte b
+	// followed by k zero bytes
+	struct Crc32cTables
+	{
+		uint32_t table[8][256];
+
+		Crc32cTables()
+		{
+			for (uint32_t b = 0; b < 256; ++b)
+			{
+				uint32_t crc = b;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+				table[0][b] = crc;
+			}
+			for (uint32_t b = 0; b < 256; ++b)
+				for (int k = 1; k < 8; ++k)
+					table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+		}
+	};
+
+	// Portable CRC32C, eight bytes per step
+	uint32_t crc32c_software(const unsigned char *data, size_t size, uint32_t crc)
+	{
+		static const Crc32cTables tables;
+		const auto &t = tables.table;
+
+		for (; size >= 8; data += 8, size -= 8)
+		{
+			uint32_t low = crc ^ read_le32(data);
+			uint32_t high = read_le32(data + 4);
+			crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+				  t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+		}
+		for (; size > 0; ++data, --size)
+			crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+		return crc;
+	}
+
+#if defined(HUFFMAN_CRC32C_SSE42)
+	// SSE4.2 CRC32C, only called after checking the CPU supports it
+	__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(const unsigned char *data, size_t size, uint32_t crc)
+	{
+#if defined(__x86_64__)
+		uint64_t wide = crc;
+		for (; size >= 8; data += 8, size -= 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, data, 8);
+			wide = _mm_crc32_u64(wide, word);
+		}
+		crc = static_cast<uint32_t>(wide);
+#endif
+		for (; size >= 4; data += 4, size -= 4)
+		{
+			uint32_t word;
+			std::memcpy(&word, data, 4);
+			crc = _mm_crc32_u32(crc, word);
+		}
+		for (; size > 0; ++data, --size)
+			crc = _mm_crc32_u8(crc, *data);
+		return crc;
+	}
+#elif defined(HUFFMAN_CRC32C_ARM)
+	// ARMv8 CRC32C, the extension is guaranteed by the compiler target
+	uint32_t crc32c_arm(const unsigned char *data, size_t size, uint32_t crc)
+	{
+		for (; size >= 8; data += 8, size -= 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, data, 8);
+			crc = __crc32cd(crc, word);
+		}
+		for (; size > 0; ++data, --size)
+			crc = __crc32cb(crc, *data);
+		return crc;
+	}
+#endif
+}
+
+// Function to compute the CRC32C of a buffer
+uint32_t crc32c(const unsigned char *data, size_t size, uint32_t crc)
+{
+	crc = ~crc;
+#if defined(HUFFMAN_CRC32C_SSE42)
+	static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+	crc = has_sse42 ? crc32c_sse42(data, size, crc) : crc32c_software(data, size, crc);
+#elif defined(HUFFMAN_CRC32C_ARM)
+	crc = crc32c_arm(data, size, crc);
+#else
+	crc = crc32c_software(data, size, crc);
+#endif
+	return ~crc;
+}
+
+// Function to append the container header
+void write_file_header(std::vector<unsigned char> &out, const FileHeader &header)
+{
+	write_le32(out, FILE_MAGIC);
+	out.push_back(header.version);
+	out.push_back(header.flags);
+	out.push_back(header.final_bits);
+	out.push_back(0);
+	write_le64(out, header.original_size);
+	write_le32(out, header.checksum);
+}
+
+// Function to parse the container header
+HeaderStatus read_file_header(const unsigned char *data, size_t size, FileHeader &header)
+{
+	if (size < FILE_HEADER_SIZE || read_le32(data) != FILE_MAGIC)
+		return HeaderStatus::NONE;
+
+	header.version = data[4];
+	header.flags = data[5];
+	header.final_bits = data[6];
+	header.original_size = read_le64(data + 8);
+	header.checksum = read_le32(data + 16);
+	if (header.version < 1 || header.version > FILE_VERSION || (header.flags & ~FILE_FLAGS_KNOWN) != 0 || header.final_bits > 8)
+		return HeaderStatus::UNSUPPORTED;
+	return HeaderStatus::OK;
+}
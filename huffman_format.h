@@ -0,0 +1,71 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_FORMAT_H
+#define HUFFMAN_FORMAT_H
+
+#include "huffman_compression.h"
+
+// Marks a Huffman file with a container header ("AHUF")
+constexpr uint32_t FILE_MAGIC = 0x46554841;
+
+// Container version written by this library, readers reject newer ones
+constexpr uint8_t FILE_VERSION = 1;
+
+// Size of the container header
+constexpr size_t FILE_HEADER_SIZE = 20;
+
+// Container flags, they say how the rest of the file is laid out
+constexpr uint8_t FILE_FLAG_CANONICAL = 0x01;   // Code lengths only, otherwise the explicit dictionary
+constexpr uint8_t FILE_FLAG_BLOCKED = 0x02;     // A block stream with its index, see huffman_stream.h
+constexpr uint8_t FILE_FLAG_INTERLEAVED = 0x04; // INTERLEAVED_STREAMS bitstreams behind a jump table
+constexpr uint8_t FILE_FLAG_DICTIONARY = 0x08;  // uint32 id of a shared dictionary instead of code lengths
+constexpr uint8_t FILE_FLAG_BYTE_PAIRS = 0x10;  // Coded over the byte-pair alphabet, see huffman_pairs.h
+constexpr uint8_t FILE_FLAGS_KNOWN = FILE_FLAG_CANONICAL | FILE_FLAG_BLOCKED | FILE_FLAG_INTERLEAVED | FILE_FLAG_DICTIONARY | FILE_FLAG_BYTE_PAIRS;
+
+// Container header, stored little-endian at the start of every file written
+// by compress_file:
+//   uint32 FILE_MAGIC
+//   uint8 version
+//   uint8 flags
+//   uint8 final_bits     valid bits in the last byte of a single bitstream
+//                        (1 to 8), 0 when there is none
+//   uint8 reserved       0
+//   uint64 original_size bytes of input
+//   uint32 checksum      CRC32C of the input
+//
+// The dictionary (or code lengths, or the id of a shared dictionary, see
+// huffman_dictionary.h, or the pair table and code lengths of
+// encode_byte_pairs) and packed data follow for single table files; block
+// files hold the block stream, whose index offsets count from the start of
+// the file.
+struct FileHeader
+{
+    uint8_t version = FILE_VERSION;
+    uint8_t flags = 0;
+    uint8_t final_bits = 0;
+    uint64_t original_size = 0;
+    uint32_t checksum = 0;
+};
+
+// Function to compute the CRC32C (Castagnoli) of data[0, size), continuing
+// from crc; uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them
+uint32_t crc32c(const unsigned char *data, size_t size, uint32_t crc = 0);
+
+// Function to append the container header
+void write_file_header(std::vector<unsigned char> &out, const FileHeader &header);
+
+// What read_file_header found at the start of a file
+enum class HeaderStatus
+{
+    NONE,        // No container header: a headerless file of an older version
+    OK,
+    UNSUPPORTED, // A container header of a newer version, with unknown flags or bad final_bits
+};
+
+// Function to parse the container header at data
+HeaderStatus read_file_header(const unsigned char *data, size_t size, FileHeader &header);
+
+#endif // HUFFMAN_FORMAT_H
@@ -0,0 +1,263 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_mmap.h"
+#include "huffman_pipeline.h"
+
+#include <cstdio>
+#include <iterator>
+#include <new>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedInput::MappedInput() : view(nullptr), length(0), mapping(nullptr)
+{
+}
+
+MappedInput::~MappedInput()
+{
+	close();
+}
+
+// Function to map the file, falling back to reading it
+bool MappedInput::open(const std::string &path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER file_size;
+	if (file != INVALID_HANDLE_VALUE && GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+	{
+		HANDLE handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (handle != nullptr)
+		{
+			mapping = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(handle); // The view keeps the mapping alive
+		}
+		if (mapping != nullptr)
+		{
+			view = static_cast<const unsigned char *>(mapping);
+			length = static_cast<size_t>(file_size.QuadPart);
+		}
+	}
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	struct stat info;
+	if (file >= 0 && fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		void *address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		if (address != MAP_FAILED)
+		{
+			madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+			mapping = address;
+			view = static_cast<const unsigned char *>(address);
+			length = static_cast<size_t>(info.st_size);
+		}
+	}
+	if (file >= 0)
+		::close(file); // The mapping stays valid after the descriptor is closed
+#endif
+
+	if (mapping != nullptr)
+		return true;
+
+	// Pipes, empty files and failed mappings are read through a stream
+	std::ifstream infile(path, std::ios::binary);
+	if (!infile.is_open())
+		return false;
+	buffer.assign(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>());
+	view = buffer.data();
+	length = buffer.size();
+	return true;
+}
+
+// Function to release the mapping or buffer
+void MappedInput::close()
+{
+	if (mapping != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mapping);
+#else
+		munmap(mapping, length);
+#endif
+	}
+	mapping = nullptr;
+	view = nullptr;
+	length = 0;
+	buffer.clear();
+	buffer.shrink_to_fit();
+}
+
+#ifdef _WIN32
+MappedOutput::MappedOutput() : view(nullptr), length(0), mapping(nullptr), owns_file(false), file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr)
+{
+}
+#else
+MappedOutput::MappedOutput() : view(nullptr), length(0), mapping(nullptr), owns_file(false), fd(-1)
+{
+}
+#endif
+
+MappedOutput::~MappedOutput()
+{
+	discard();
+}
+
+// Function to create the file and map it, falling back to a buffer
+bool MappedOutput::create(const std::string &path, size_t size)
+{
+	discard();
+	this->path = path;
+	length = size;
+
+#ifdef _WIN32
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	owns_file = file_handle != INVALID_HANDLE_VALUE && GetFileType(file_handle) == FILE_TYPE_DISK;
+	if (owns_file && size > 0)
+	{
+		// Creating the mapping extends the file to its final size
+		uint64_t wide_size = size;
+		mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READWRITE, static_cast<DWORD>(wide_size >> 32),
+											static_cast<DWORD>(wide_size), nullptr);
+		if (mapping_handle != nullptr)
+			mapping = MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, size);
+	}
+	else if (file_handle != INVALID_HANDLE_VALUE && size == 0)
+	{
+		return true; // Nothing to map, the file is already empty
+	}
+	if (mapping == nullptr && file_handle != INVALID_HANDLE_VALUE)
+	{
+		if (mapping_handle != nullptr)
+			CloseHandle(mapping_handle);
+		CloseHandle(file_handle);
+		mapping_handle = nullptr;
+		file_handle = INVALID_HANDLE_VALUE;
+	}
+#else
+	struct stat info;
+	bool regular = stat(path.c_str(), &info) != 0 || S_ISREG(info.st_mode);
+	if (regular)
+	{
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		owns_file = fd >= 0;
+		if (fd >= 0 && size == 0)
+			return true; // Nothing to map, the file is already empty
+		if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0)
+		{
+			void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (address != MAP_FAILED)
+				mapping = address;
+		}
+		if (mapping == nullptr && fd >= 0)
+		{
+			::close(fd);
+			fd = -1;
+		}
+	}
+#endif
+
+	if (mapping != nullptr)
+	{
+		view = static_cast<unsigned char *>(mapping);
+		return true;
+	}
+
+	// Pipes and failed mappings collect the output and write it on commit()
+	try
+	{
+		buffer.assign(size, 0);
+	}
+	catch (const std::bad_alloc &)
+	{
+		discard();
+		return false;
+	}
+	view = buffer.data();
+	return true;
+}
+
+// Function to finish the file
+bool MappedOutput::commit()
+{
+	if (mapping != nullptr || length == 0)
+	{
+		unmap();
+		owns_file = false;
+		return true;
+	}
+
+	std::ofstream outfile(path, std::ios::binary);
+	outfile.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+	outfile.close();
+	unmap();
+	if (!outfile)
+		return false;
+	owns_file = false;
+	return true;
+}
+
+// Function to drop the output, removing the file create() made for it
+void MappedOutput::discard()
+{
+	unmap();
+	if (owns_file)
+		std::remove(path.c_str());
+	owns_file = false;
+}
+
+// Function to drop the mapping and close the file
+void MappedOutput::unmap()
+{
+#ifdef _WIN32
+	if (mapping != nullptr)
+		UnmapViewOfFile(mapping);
+	if (mapping_handle != nullptr)
+		CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+	mapping_handle = nullptr;
+	file_handle = INVALID_HANDLE_VALUE;
+#else
+	if (mapping != nullptr)
+		munmap(mapping, length);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+	mapping = nullptr;
+	view = nullptr;
+	buffer.clear();
+	buffer.shrink_to_fit();
+}
+
+// Function to compress a file straight from its mapping
+HuffmanStatus compress_path(const std::string &input_filename, const std::string &huffman_name, const CompressionOptions &options)
+{
+	if (options.pipeline && options.block_size > 0)
+		return compress_file_pipelined(input_filename, huffman_name, options);
+
+	StageTimer open_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	MappedInput input;
+	if (!input.open(input_filename))
+		return HuffmanStatus::INPUT_OPEN_FAILED;
+	open_timer.stop();
+
+	return compress_data(input.data(), input.size(), huffman_name, options);
+}
@@ -0,0 +1,91 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_MMAP_H
+#define HUFFMAN_MMAP_H
+
+#include "huffman_compression.h"
+
+// Read-only view of a whole file: a memory mapping of regular files, or the
+// contents read into a buffer for pipes and anything else that cannot be mapped
+class MappedInput
+{
+public:
+    MappedInput();
+    ~MappedInput();
+
+    MappedInput(const MappedInput &) = delete;
+    MappedInput &operator=(const MappedInput &) = delete;
+
+    // Function to map (or read) the file, returns false when it cannot be opened
+    bool open(const std::string &path);
+
+    // Function to release the mapping or buffer
+    void close();
+
+    const unsigned char *data() const { return view; }
+    size_t size() const { return length; }
+
+    // Whether data() is a mapping rather than the buffered fallback
+    bool mapped() const { return mapping != nullptr; }
+
+private:
+    const unsigned char *view;
+    size_t length;
+    void *mapping;                     // Start of the mapping, nullptr when buffered
+    std::vector<unsigned char> buffer; // Fallback contents
+};
+
+// Writable, pre-sized output file: a shared mapping of the file when
+// possible, otherwise a buffer written out by commit(). A regular file that
+// is not committed is removed when the output is destroyed, so failed
+// decodes leave no pre-sized file of zeros behind.
+class MappedOutput
+{
+public:
+    MappedOutput();
+    ~MappedOutput();
+
+    MappedOutput(const MappedOutput &) = delete;
+    MappedOutput &operator=(const MappedOutput &) = delete;
+
+    // Function to create (or truncate) the file with exactly size bytes,
+    // returns false when it can be neither mapped nor buffered
+    bool create(const std::string &path, size_t size);
+
+    // Function to finish the file, returns false when the data could not be
+    // written (the file is then removed like an uncommitted one)
+    bool commit();
+
+    unsigned char *data() { return view; }
+    size_t size() const { return length; }
+
+    // Whether data() is a mapping rather than the buffered fallback
+    bool mapped() const { return mapping != nullptr; }
+
+private:
+    void unmap();
+    void discard();
+
+    std::string path;
+    unsigned char *view;
+    size_t length;
+    void *mapping;                     // Start of the mapping, nullptr when buffered
+    std::vector<unsigned char> buffer; // Fallback contents
+    bool owns_file;                    // create() made or truncated a regular file at path that is not committed
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#else
+    int fd;
+#endif
+};
+
+// Function to compress the file at input_filename, coding straight from a
+// mapping of it; with options.pipeline block files are read, coded and
+// written in overlapping stages instead, see compress_file_pipelined
+HuffmanStatus compress_path(const std::string &input_filename, const std::string &huffman_name, const CompressionOptions &options = CompressionOptions());
+
+#endif // HUFFMAN_MMAP_H
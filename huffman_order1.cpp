@@ -0,0 +1,155 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_order1.h"
+
+// Function to pick the contexts and build a code for each of them
+uint64_t build_order1_model(const unsigned char *data, size_t size, const std::array<unsigned int, NUM_CHAR> &frequency, int max_code_length,
+							Order1Model &model)
+{
+	// The most frequent bytes are the best predictors of what follows them
+	std::array<uint16_t, NUM_CHAR> order;
+	for (int i = 0; i < NUM_CHAR; ++i)
+		order[i] = static_cast<uint16_t>(i);
+	std::stable_sort(order.begin(), order.end(), [&frequency](uint16_t a, uint16_t b)
+					 { return frequency[a] > frequency[b]; });
+
+	model.context_of.fill(0);
+	model.context_count = 1;
+	for (int k = 0; k < ORDER1_MAX_CONTEXTS - 1 && frequency[order[k]] > 0; ++k)
+	{
+		model.owner[model.context_count] = static_cast<uint8_t>(order[k]);
+		model.context_of[order[k]] = static_cast<uint8_t>(model.context_count++);
+	}
+
+	// Count every byte in the context of the one before it
+	std::array<std::array<unsigned int, NUM_CHAR>, ORDER1_MAX_CONTEXTS> counts{};
+	unsigned char previous = 0;
+	for (size_t i = 0; i < size; ++i)
+	{
+		counts[model.context_of[previous]][data[i]]++;
+		previous = data[i];
+	}
+
+	std::vector<unsigned char> header;
+	uint64_t bits = 0;
+	for (int c = 0; c < model.context_count; ++c)
+	{
+		build_code_lengths(counts[c], max_code_length, model.lengths[c]);
+		for (int i = 0; i < NUM_CHAR; ++i)
+			bits += static_cast<uint64_t>(counts[c][i]) * model.lengths[c][i];
+	}
+	write_order1_model(header, model);
+	return bits + 8 * header.size();
+}
+
+// Function to serialize the model
+void write_order1_model(std::vector<unsigned char> &out, const Order1Model &model)
+{
+	out.push_back(static_cast<unsigned char>(model.context_count));
+	for (int c = 1; c < model.context_count; ++c)
+		out.push_back(model.owner[c]);
+	for (int c = 0; c < model.context_count; ++c)
+		write_code_lengths(out, model.lengths[c]);
+}
+
+// Function to parse a serialized model
+size_t read_order1_model(const unsigned char *data, size_t size, Order1Model &model)
+{
+	if (size < 1 || data[0] < 1 || data[0] > ORDER1_MAX_CONTEXTS || size < data[0])
+		return 0;
+
+	model.context_count = data[0];
+	model.context_of.fill(0);
+	size_t pos = 1;
+	for (int c = 1; c < model.context_count; ++c)
+	{
+		uint8_t owner = data[pos++];
+		if (model.context_of[owner] != 0)
+			return 0; // Two contexts for the same byte
+		model.owner[c] = owner;
+		model.context_of[owner] = static_cast<uint8_t>(c);
+	}
+
+	for (int c = 0; c < model.context_count; ++c)
+	{
+		size_t consumed = read_code_lengths(data + pos, size - pos, model.lengths[c]);
+		if (consumed == 0)
+			return 0;
+		pos += consumed;
+	}
+	return pos;
+}
+
+// Function to encode with the table of every byte's context
+uint64_t encode_data_order1(const unsigned char *data, size_t size, const Order1Model &model, std::vector<unsigned char> &packed)
+{
+	std::vector<CodeTable> codes(model.context_count);
+	for (int c = 0; c < model.context_count; ++c)
+		build_canonical_codes(model.lengths[c], codes[c]);
+
+	BitWriter writer(packed);
+	unsigned char previous = 0;
+	for (size_t i = 0; i < size; ++i)
+	{
+		const Codeword &code = codes[model.context_of[previous]][data[i]];
+		writer.put(code.bits, code.length);
+		previous = data[i];
+	}
+	writer.flush();
+	return writer.bit_count();
+}
+
+// Function to build the decode tables of the contexts
+bool build_order1_tables(const Order1Model &model, std::vector<DecodeTable> &tables)
+{
+	tables.resize(model.context_count);
+	for (int c = 0; c < model.context_count; ++c)
+	{
+		CodeTable codes{};
+		if (!build_canonical_codes(model.lengths[c], codes) || !build_decode_table(codes, tables[c]))
+			return false;
+	}
+	return true;
+}
+
+// Function to decode with the table of every symbol's context; the paired
+// entries of the tables are not used, the second symbol has a context of its own
+size_t decode_symbols_order1(const unsigned char *data, size_t size, const Order1Model &model, const std::vector<DecodeTable> &tables,
+							 unsigned char *out, size_t count)
+{
+	BitReader reader(data, size);
+	unsigned char previous = 0;
+	size_t produced = 0;
+
+	// While whole words remain a refill leaves at least 56 real bits, enough
+	// for two codes of the longest length the tables hold
+	while (count - produced >= 2 && reader.has_word())
+	{
+		reader.refill();
+		for (int k = 0; k < 2; ++k)
+		{
+			const DecodeEntry &entry = tables[model.context_of[previous]].lookup(reader.bits());
+			if (entry.length == 0)
+				return produced;
+			reader.consume(entry.length);
+			previous = static_cast<unsigned char>(entry.value);
+			out[produced++] = previous;
+		}
+	}
+
+	for (; produced < count; ++produced)
+	{
+		reader.refill();
+		const DecodeEntry &entry = tables[model.context_of[previous]].lookup(reader.bits());
+		reader.consume(entry.length);
+		if (entry.length == 0 || reader.available() < 0)
+			break; // Not a valid code, or it runs past the end of the data
+
+		previous = static_cast<unsigned char>(entry.value);
+		out[produced] = previous;
+	}
+	return produced;
+}
@@ -0,0 +1,58 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_ORDER1_H
+#define HUFFMAN_ORDER1_H
+
+#include "huffman_compression.h"
+
+// Most code tables of one order-1 block, bounds its header and keeps the
+// decode tables of a block within the L2 cache
+constexpr int ORDER1_MAX_CONTEXTS = 8;
+
+// Order-1 model of a block: every byte is coded with the table of the
+// context its previous byte falls into (the first byte of a block follows a
+// virtual 0). The ORDER1_MAX_CONTEXTS - 1 most frequent bytes each get a
+// context of their own, all other bytes share context 0.
+//
+// Serialized as:
+//   uint8 context_count  1 to ORDER1_MAX_CONTEXTS
+//   the byte owning each context 1 to context_count - 1, one byte each
+//   code lengths of every context, run-length coded (see write_code_lengths)
+struct Order1Model
+{
+    std::array<uint8_t, NUM_CHAR> context_of{}; // Context of the byte after each byte value
+    std::array<uint8_t, ORDER1_MAX_CONTEXTS> owner{}; // Byte owning each context, unused for context 0
+    int context_count = 1;
+    std::array<CodeLengths, ORDER1_MAX_CONTEXTS> lengths{};
+};
+
+// Function to build the order-1 model of data[0, size) from its byte
+// frequencies, with codes no longer than max_code_length (0 for no limit),
+// returns the size of its serialized header and packed data in bits
+uint64_t build_order1_model(const unsigned char *data, size_t size, const std::array<unsigned int, NUM_CHAR> &frequency, int max_code_length,
+                            Order1Model &model);
+
+// Function to append the serialized model
+void write_order1_model(std::vector<unsigned char> &out, const Order1Model &model);
+
+// Function to parse a serialized model, returns the bytes consumed or 0 when
+// it is malformed
+size_t read_order1_model(const unsigned char *data, size_t size, Order1Model &model);
+
+// Function to encode data[0, size) with the model's tables into packed bits,
+// returns the number of bits written
+uint64_t encode_data_order1(const unsigned char *data, size_t size, const Order1Model &model, std::vector<unsigned char> &packed);
+
+// Function to build a decode table per context of the model, returns false
+// when a context's lengths are not a prefix code the tables can hold
+bool build_order1_tables(const Order1Model &model, std::vector<DecodeTable> &tables);
+
+// Function to decode exactly count symbols of order-1 packed data, returns
+// the number decoded (less than count when the data is malformed)
+size_t decode_symbols_order1(const unsigned char *data, size_t size, const Order1Model &model, const std::vector<DecodeTable> &tables,
+                             unsigned char *out, size_t count);
+
+#endif // HUFFMAN_ORDER1_H
@@ -0,0 +1,161 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_pairs.h"
+
+#include <cstring>
+
+// Bytes a symbol of the pair alphabet stands for
+struct PairSpelling
+{
+	unsigned char bytes[2];
+	uint8_t width; // 1 for byte values, 2 for pairs
+};
+
+// Function to pick the most frequent byte pairs
+void build_byte_pair_table(const unsigned char *data, size_t size, BytePairTable &table)
+{
+	std::vector<unsigned int> counts(size_t(1) << 16, 0);
+	for (size_t i = 0; i + 1 < size; ++i)
+		counts[(data[i] << 8) | data[i + 1]]++;
+
+	table.pairs.clear();
+	for (size_t pair = 0; pair < counts.size(); ++pair)
+	{
+		if (counts[pair] >= MIN_PAIR_COUNT)
+			table.pairs.push_back(static_cast<uint16_t>(pair));
+	}
+	std::stable_sort(table.pairs.begin(), table.pairs.end(), [&counts](uint16_t a, uint16_t b)
+					 { return counts[a] > counts[b]; });
+	if (table.pairs.size() > MAX_BYTE_PAIRS)
+		table.pairs.resize(MAX_BYTE_PAIRS);
+
+	index_byte_pairs(table);
+}
+
+// Function to map every byte pair to its symbol
+void index_byte_pairs(BytePairTable &table)
+{
+	table.symbol_of.assign(size_t(1) << 16, 0);
+	for (size_t k = 0; k < table.pairs.size(); ++k)
+		table.symbol_of[table.pairs[k]] = static_cast<PairSymbol>(NUM_CHAR + k);
+}
+
+// Function to turn bytes into pair alphabet symbols
+void tokenize_byte_pairs(const unsigned char *data, size_t size, const BytePairTable &table, std::vector<PairSymbol> &symbols)
+{
+	symbols.clear();
+	symbols.reserve(size);
+	size_t i = 0;
+	while (i + 1 < size)
+	{
+		PairSymbol pair = table.symbol_of[(data[i] << 8) | data[i + 1]];
+		symbols.push_back(pair != 0 ? pair : data[i]);
+		i += pair != 0 ? 2 : 1;
+	}
+	if (i < size)
+		symbols.push_back(data[i]);
+}
+
+// Function to code bytes over the pair alphabet
+uint64_t encode_byte_pairs(const unsigned char *data, size_t size, int max_code_length, std::vector<unsigned char> &out)
+{
+	BytePairTable table;
+	build_byte_pair_table(data, size, table);
+	std::vector<PairSymbol> symbols;
+	tokenize_byte_pairs(data, size, table, symbols);
+
+	// The tables of the larger alphabet do not belong on the stack
+	auto frequency = std::make_unique<SymbolFrequency<PAIR_ALPHABET_SIZE>>();
+	auto lengths = std::make_unique<SymbolLengths<PAIR_ALPHABET_SIZE>>();
+	auto codes = std::make_unique<SymbolCodes<PAIR_ALPHABET_SIZE>>();
+	fill_symbol_frequency(symbols.data(), symbols.size(), *frequency);
+	max_code_length = max_code_length > 0 ? std::min(max_code_length, MAX_TABLE_CODE_LENGTH) : MAX_TABLE_CODE_LENGTH;
+	build_symbol_code_lengths(*frequency, max_code_length, *lengths);
+	build_symbol_canonical_codes(*lengths, *codes);
+
+	out.push_back(static_cast<unsigned char>(table.pairs.size()));
+	out.push_back(static_cast<unsigned char>(table.pairs.size() >> 8));
+	for (uint16_t pair : table.pairs)
+	{
+		out.push_back(static_cast<unsigned char>(pair >> 8));
+		out.push_back(static_cast<unsigned char>(pair));
+	}
+	write_symbol_code_lengths(out, *lengths);
+	return encode_symbols(symbols.data(), symbols.size(), *codes, out);
+}
+
+// Function to decode pair alphabet symbols straight into their bytes
+bool decode_byte_pairs(const unsigned char *data, size_t size, unsigned char *out, size_t out_size)
+{
+	if (size < 2)
+		return false;
+	const size_t pair_count = data[0] | (data[1] << 8);
+	if (pair_count > MAX_BYTE_PAIRS || size - 2 < 2 * pair_count)
+		return false;
+
+	std::vector<PairSpelling> spelling(PAIR_ALPHABET_SIZE, PairSpelling{{0, 0}, 0});
+	for (int i = 0; i < NUM_CHAR; ++i)
+		spelling[i] = PairSpelling{{static_cast<unsigned char>(i), 0}, 1};
+	for (size_t k = 0; k < pair_count; ++k)
+		spelling[NUM_CHAR + k] = PairSpelling{{data[2 + 2 * k], data[3 + 2 * k]}, 2};
+	size_t pos = 2 + 2 * pair_count;
+
+	auto lengths = std::make_unique<SymbolLengths<PAIR_ALPHABET_SIZE>>();
+	auto codes = std::make_unique<SymbolCodes<PAIR_ALPHABET_SIZE>>();
+	DecodeTable table;
+	size_t consumed = read_symbol_code_lengths(data + pos, size - pos, *lengths);
+	if (consumed == 0 || std::any_of(lengths->begin() + NUM_CHAR + pair_count, lengths->end(), [](uint8_t length)
+									 { return length != 0; }))
+		return false; // Codes for pairs the table does not spell
+	if (!build_symbol_canonical_codes(*lengths, *codes) || !build_symbol_decode_table(*codes, table))
+		return false;
+	pos += consumed;
+
+	BitReader reader(data + pos, size - pos);
+	size_t produced = 0;
+
+	// Fast loop: a whole code pair is in the window and room for four bytes
+	// remains, so both spellings are copied whole
+	while (out_size - produced >= 4 && reader.has_word())
+	{
+		reader.refill();
+
+		const DecodeEntry &entry = table.lookup(reader.bits());
+		if (entry.length == 0)
+			return false; // Not a valid code
+
+		const PairSpelling &first = spelling[entry.value & 0xFFFF];
+		std::memcpy(out + produced, first.bytes, 2);
+		produced += first.width;
+		if (entry.pair_length != 0)
+		{
+			const PairSpelling &second = spelling[entry.value >> 16];
+			std::memcpy(out + produced, second.bytes, 2);
+			produced += second.width;
+			reader.consume(entry.pair_length);
+		}
+		else
+		{
+			reader.consume(entry.length);
+		}
+	}
+
+	// Checked loop for the end of the data and the output
+	while (produced < out_size)
+	{
+		reader.refill();
+
+		const DecodeEntry &entry = table.lookup(reader.bits());
+		const PairSpelling &symbol = spelling[entry.value & 0xFFFF];
+		if (entry.length == 0 || entry.length > reader.available() || symbol.width > out_size - produced)
+			return false; // Not a valid code, truncated data, or more bytes than the header says
+
+		std::memcpy(out + produced, symbol.bytes, symbol.width);
+		produced += symbol.width;
+		reader.consume(entry.length);
+	}
+	return true;
+}
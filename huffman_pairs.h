@@ -0,0 +1,53 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_PAIRS_H
+#define HUFFMAN_PAIRS_H
+
+#include "huffman_alphabet.h"
+
+// Symbols of the byte-pair alphabet: the NUM_CHAR byte values, then one
+// extended symbol per frequent byte pair
+using PairSymbol = uint16_t;
+constexpr size_t PAIR_ALPHABET_SIZE = 4096;
+constexpr size_t MAX_BYTE_PAIRS = PAIR_ALPHABET_SIZE - NUM_CHAR;
+
+// Fewest occurrences that earn a byte pair its own symbol, rarer pairs do
+// not pay for their table entry
+constexpr unsigned int MIN_PAIR_COUNT = 16;
+
+// Byte pairs that have their own symbol; pair k is symbol NUM_CHAR + k
+struct BytePairTable
+{
+    std::vector<uint16_t> pairs;       // First byte << 8 | second byte of every pair
+    std::vector<PairSymbol> symbol_of; // Symbol of every byte pair, 0 when it has none (filled by index_byte_pairs)
+};
+
+// Function to choose the MAX_BYTE_PAIRS most frequent byte pairs of
+// data[0, size) seen at least MIN_PAIR_COUNT times
+void build_byte_pair_table(const unsigned char *data, size_t size, BytePairTable &table);
+
+// Function to fill table.symbol_of from table.pairs
+void index_byte_pairs(BytePairTable &table);
+
+// Function to turn data[0, size) into symbols, taking the pairs of the table
+// greedily from left to right
+void tokenize_byte_pairs(const unsigned char *data, size_t size, const BytePairTable &table, std::vector<PairSymbol> &symbols);
+
+// Function to append data[0, size) coded over the byte-pair alphabet, with
+// codes no longer than max_code_length (capped to MAX_TABLE_CODE_LENGTH),
+// returns the number of packed bits:
+//   uint16 pair_count
+//   per pair: first byte, second byte
+//   code lengths of the PAIR_ALPHABET_SIZE symbols, see
+//   write_symbol_code_lengths; pairs past pair_count have length 0
+//   packed data          canonical codes, MSB first, zero padded
+uint64_t encode_byte_pairs(const unsigned char *data, size_t size, int max_code_length, std::vector<unsigned char> &out);
+
+// Function to decode data written by encode_byte_pairs into exactly
+// out_size bytes, returns false when it is malformed or decodes to another size
+bool decode_byte_pairs(const unsigned char *data, size_t size, unsigned char *out, size_t out_size);
+
+#endif // HUFFMAN_PAIRS_H
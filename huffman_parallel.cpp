@@ -0,0 +1,441 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_parallel.h"
+#include "huffman_format.h"
+#include "huffman_mmap.h"
+
+#include <atomic>
+
+ThreadPool::ThreadPool(unsigned threads) : head(0), queued(0), running(0), stopping(false)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	workers.reserve(threads);
+	for (unsigned i = 0; i < threads; ++i)
+		workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	task_ready.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+// Function to queue a task for the next free worker
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// The ring only grows, so once it holds the most tasks ever queued submitting does not allocate
+		if (queued == tasks.size())
+		{
+			std::vector<std::function<void()>> grown(std::max<size_t>(8, 2 * tasks.size()));
+			for (size_t i = 0; i < queued; ++i)
+				grown[i] = std::move(tasks[(head + i) % tasks.size()]);
+			tasks.swap(grown);
+			head = 0;
+		}
+		tasks[(head + queued) % tasks.size()] = std::move(task);
+		++queued;
+	}
+	task_ready.notify_one();
+}
+
+// Function to block until the queue is empty and no task is running
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	all_done.wait(lock, [this]
+				  { return queued == 0 && running == 0; });
+}
+
+// Worker body: run tasks until the pool is destroyed
+void ThreadPool::worker_loop()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			task_ready.wait(lock, [this]
+							{ return stopping || queued != 0; });
+			if (queued == 0)
+				return; // Stopping with nothing left to do
+
+			task = std::move(tasks[head]);
+			tasks[head] = nullptr;
+			head = (head + 1) % tasks.size();
+			--queued;
+			++running;
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--running;
+			if (queued == 0 && running == 0)
+				all_done.notify_all();
+		}
+	}
+}
+
+// Function to code the blocks concurrently and hand them out in order
+bool encode_blocks_parallel(const unsigned char *data, size_t size, const CompressionOptions &options,
+							const std::function<bool(const std::vector<unsigned char> &)> &sink)
+{
+	const size_t block_size = std::min(std::max<size_t>(options.block_size, 1), MAX_BLOCK_SIZE);
+	const size_t block_count = (size + block_size - 1) / block_size;
+
+	ThreadPool pool(options.threads);
+	const size_t window = 2 * static_cast<size_t>(pool.size());
+
+	// Ring of block slots, slot i % window holds block i while it is in flight
+	struct Slot
+	{
+		std::vector<unsigned char> encoded;
+		BlockPlan plan;
+		CompressionStats stats; // Times of this block, only kept with options.stats
+		bool ready = false;
+	};
+	std::vector<Slot> slots(window);
+	std::mutex mutex;
+	std::condition_variable block_ready;
+
+	// Table reuse depends on the block before, so those blocks are planned here in order
+	BlockPlan previous;
+	bool has_previous = false;
+	auto submit_block = [&](size_t index)
+	{
+		if (options.reuse_tables)
+		{
+			size_t offset = index * block_size;
+			Slot &slot = slots[index % window];
+			slot.stats = CompressionStats();
+			plan_block(data + offset, std::min(block_size, size - offset), options, has_previous ? &previous : nullptr, slot.plan,
+					   options.stats != nullptr ? &slot.stats : nullptr);
+			if (slot.plan.type == BLOCK_TYPE_HUFFMAN)
+			{
+				previous = slot.plan;
+				has_previous = true;
+			}
+		}
+
+		pool.submit([&, index]
+					{
+						size_t offset = index * block_size;
+						Slot &slot = slots[index % window];
+						CompressionStats *stats = options.stats != nullptr ? &slot.stats : nullptr;
+						if (!options.reuse_tables)
+						{
+							slot.stats = CompressionStats();
+							plan_block(data + offset, std::min(block_size, size - offset), options, nullptr, slot.plan, stats);
+						}
+						slot.encoded.clear();
+						StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+						encode_block(data + offset, std::min(block_size, size - offset), options, slot.plan, slot.encoded);
+						code_timer.stop();
+
+						std::lock_guard<std::mutex> lock(mutex);
+						slot.ready = true;
+						block_ready.notify_all(); });
+	};
+
+	size_t submitted = 0;
+	for (; submitted < std::min(window, block_count); ++submitted)
+		submit_block(submitted);
+
+	bool ok = true;
+	for (size_t index = 0; index < block_count; ++index)
+	{
+		Slot &slot = slots[index % window];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			block_ready.wait(lock, [&slot]
+							 { return slot.ready; });
+			slot.ready = false;
+		}
+
+		if (!sink(slot.encoded))
+		{
+			ok = false;
+			break;
+		}
+
+		const size_t done = std::min(size, (index + 1) * block_size);
+		if (options.stats != nullptr)
+		{
+			record_block_stats(slot.plan, done - index * block_size, slot.stats);
+			merge_stats(*options.stats, slot.stats);
+		}
+		if (options.progress)
+			options.progress(done, size);
+
+		// The slot is free again, reuse it for the next block
+		if (submitted < block_count)
+			submit_block(submitted++);
+	}
+
+	pool.wait();
+	return ok;
+}
+
+ParallelBlockDecoder::ParallelBlockDecoder(unsigned threads)
+	: data(nullptr), size(0), index(nullptr), out(nullptr), stats(nullptr), progress(nullptr), next(0), ok(true), total(0), done(0), pool(threads)
+{
+	workers.resize(pool.size());
+}
+
+// Function to decode the indexed blocks concurrently into their final place
+bool ParallelBlockDecoder::decode(const unsigned char *data, size_t size, const std::vector<BlockIndexEntry> &index, unsigned char *out,
+								  CompressionStats *stats, const ProgressCallback &progress)
+{
+	// Blocks that repeat a table are decoded with the one of the closest block storing it
+	table_blocks.resize(index.size());
+	out_offsets.resize(index.size());
+	uint64_t out_offset = 0;
+	size_t table_block = index.size();
+	total = 0;
+	for (size_t k = 0; k < index.size(); ++k)
+	{
+		const BlockIndexEntry &block = index[k];
+		if (block_stores_table(data + block.offset, size - static_cast<size_t>(block.offset)))
+			table_block = k;
+		else if (block_repeats_table(data + block.offset, size - static_cast<size_t>(block.offset)) && table_block == index.size())
+			return false;
+		table_blocks[k] = table_block;
+		out_offsets[k] = out_offset;
+		out_offset += block.raw_size;
+	}
+	total = out_offset;
+
+	this->data = data;
+	this->size = size;
+	this->index = &index;
+	this->out = out;
+	this->stats = stats;
+	this->progress = &progress;
+	next = 0;
+	ok = true;
+	done = 0;
+
+	// One task per worker taking blocks in turn; the capture fits in the
+	// std::function, so submitting does not allocate
+	size_t tasks = std::min(workers.size(), index.size());
+	for (size_t w = 0; w < tasks; ++w)
+	{
+		workers[w].table_block = SIZE_MAX; // The tables are of the previous call's stream
+		pool.submit([this, w]
+					{ run(w); });
+	}
+	pool.wait();
+	return ok;
+}
+
+// Worker body: decode blocks with the worker's scratch until none are left
+void ParallelBlockDecoder::run(size_t w)
+{
+	Worker &worker = workers[w];
+	for (size_t k = next++; k < index->size() && ok; k = next++)
+	{
+		const BlockIndexEntry &block = (*index)[k];
+		const unsigned char *block_data = data + block.offset;
+		const size_t block_size = size - static_cast<size_t>(block.offset);
+		uint64_t code_ns = 0;
+		StageTimer code_timer(stats != nullptr ? &code_ns : nullptr);
+
+		// A repeated table is only rebuilt when the worker's last one is another block's
+		const size_t source = table_blocks[k];
+		if (block_repeats_table(block_data, block_size) && worker.table_block != source)
+		{
+			if (!read_block_table(data + (*index)[source].offset, size - static_cast<size_t>((*index)[source].offset), worker.scratch.table))
+			{
+				worker.table_block = SIZE_MAX;
+				ok = false;
+				break;
+			}
+			worker.table_block = source;
+		}
+		if (decode_block(block_data, block_size, out + out_offsets[k], block.raw_size, worker.scratch) == 0)
+		{
+			worker.table_block = SIZE_MAX;
+			ok = false;
+			break;
+		}
+		if (block_stores_table(block_data, block_size))
+			worker.table_block = k;
+		code_timer.stop();
+
+		// Workers count their blocks under the lock, so the callback is never re-entered
+		if (stats == nullptr && !*progress)
+			continue;
+		std::lock_guard<std::mutex> lock(mutex);
+		done += block.raw_size;
+		if (stats != nullptr)
+		{
+			stats->code_ns += code_ns;
+			stats->symbols += block.raw_size;
+			stats->blocks++;
+		}
+		if (*progress)
+			(*progress)(done, total);
+	}
+}
+
+// Function to decode the indexed blocks concurrently with a decoder for this call
+bool decode_blocks_parallel(const unsigned char *data, size_t size, const std::vector<BlockIndexEntry> &index, unsigned char *out,
+							unsigned threads, CompressionStats *stats, const ProgressCallback &progress)
+{
+	ParallelBlockDecoder decoder(static_cast<unsigned>(std::min<size_t>(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency()), std::max<size_t>(index.size(), 1))));
+	return decoder.decode(data, size, index, out, stats, progress);
+}
+
+// Block mode compression function
+HuffmanStatus compress_file_blocks(const unsigned char *data, size_t size, const std::string &huffman_name, const CompressionOptions &options)
+{
+	std::ofstream outfile(huffman_name, std::ios::binary);
+	if (!outfile.is_open())
+		return HuffmanStatus::HUFFMAN_CREATE_FAILED;
+
+	// Container header, the block offsets of the index count from the start of the file
+	FileHeader header;
+	header.flags = FILE_FLAG_CANONICAL | FILE_FLAG_BLOCKED | (options.interleaved ? FILE_FLAG_INTERLEAVED : 0);
+	header.original_size = size;
+	StageTimer checksum_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	header.checksum = crc32c(data, size);
+	std::vector<unsigned char> prefix;
+	write_file_header(prefix, header);
+	outfile.write(reinterpret_cast<const char *>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+	checksum_timer.stop();
+
+	std::vector<BlockIndexEntry> index;
+	uint64_t written = prefix.size();
+	bool ok = encode_blocks_parallel(data, size, options,
+									 [&](const std::vector<unsigned char> &block)
+									 {
+										 index.push_back(BlockIndexEntry{written, read_le32(block.data())});
+										 StageTimer write_timer(stat_field(options.stats, &CompressionStats::io_ns));
+										 outfile.write(reinterpret_cast<const char *>(block.data()), static_cast<std::streamsize>(block.size()));
+										 written += block.size();
+										 return static_cast<bool>(outfile);
+									 });
+
+	std::vector<unsigned char> end;
+	encode_end_block(end);
+	write_block_index(end, index);
+	StageTimer close_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	outfile.write(reinterpret_cast<const char *>(end.data()), static_cast<std::streamsize>(end.size()));
+	outfile.close();
+	close_timer.stop();
+	if (options.stats != nullptr)
+	{
+		options.stats->bytes_in += size;
+		options.stats->bytes_out += written + end.size();
+	}
+	if (!ok || !outfile)
+		return HuffmanStatus::HUFFMAN_WRITE_FAILED;
+
+	return HuffmanStatus::OK;
+}
+
+// Block mode decompression function
+HuffmanStatus decompress_file_blocks(const std::string &huffman_filename, const std::string &output_filename, const CompressionOptions &options)
+{
+	MappedInput input;
+	if (!input.open(huffman_filename))
+		return HuffmanStatus::HUFFMAN_OPEN_FAILED;
+
+	// Files with a container header are checked against its size and checksum
+	FileHeader header;
+	const HeaderStatus header_status = read_file_header(input.data(), input.size(), header);
+	if (header_status == HeaderStatus::UNSUPPORTED)
+		return HuffmanStatus::UNSUPPORTED_FORMAT;
+	const bool has_header = header_status == HeaderStatus::OK;
+	if (has_header && (header.flags & FILE_FLAG_BLOCKED) == 0)
+		return HuffmanStatus::HUFFMAN_READ_FAILED;
+
+	// Decode the blocks in parallel into the pre-sized output when the file is indexed
+	std::vector<BlockIndexEntry> index;
+	if (read_block_index(input.data(), input.size(), index))
+	{
+		uint64_t total = 0;
+		for (const BlockIndexEntry &block : index)
+			total += block.raw_size;
+		if (has_header && total != header.original_size)
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
+
+		MappedOutput output;
+		if (!output.create(output_filename, static_cast<size_t>(total)))
+			return HuffmanStatus::OUTPUT_CREATE_FAILED;
+		if (!decode_blocks_parallel(input.data(), input.size(), index, output.data(), options.threads, options.stats, options.progress))
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
+		StageTimer io_timer(stat_field(options.stats, &CompressionStats::io_ns));
+		if (has_header && crc32c(output.data(), output.size()) != header.checksum)
+			return HuffmanStatus::HUFFMAN_READ_FAILED;
+		if (!output.commit())
+			return HuffmanStatus::OUTPUT_WRITE_FAILED;
+		io_timer.stop();
+		if (options.stats != nullptr)
+		{
+			options.stats->bytes_in += input.size();
+			options.stats->bytes_out += total;
+		}
+
+		return HuffmanStatus::OK;
+	}
+	const uint64_t input_size = input.size();
+	input.close();
+
+	std::ifstream infile(huffman_filename, std::ios::binary);
+	std::ofstream outfile(output_filename, std::ios::binary);
+	if (!outfile.is_open())
+		return HuffmanStatus::OUTPUT_CREATE_FAILED;
+	if (has_header)
+		infile.seekg(static_cast<std::streamoff>(FILE_HEADER_SIZE));
+
+	StreamDecoder decoder(infile);
+	std::vector<unsigned char> buffer(DEFAULT_BLOCK_SIZE);
+	uint64_t total = 0;
+	uint32_t checksum = 0;
+	size_t count;
+	for (;;)
+	{
+		StageTimer code_timer(stat_field(options.stats, &CompressionStats::code_ns));
+		count = decoder.read(buffer.data(), buffer.size());
+		code_timer.stop();
+		if (count == 0)
+			break;
+
+		StageTimer io_timer(stat_field(options.stats, &CompressionStats::io_ns));
+		outfile.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(count));
+		total += count;
+		checksum = crc32c(buffer.data(), count, checksum);
+		io_timer.stop();
+		if (options.progress)
+			options.progress(total, has_header ? header.original_size : 0);
+	}
+	if (options.stats != nullptr)
+	{
+		options.stats->bytes_in += input_size;
+		options.stats->bytes_out += total;
+		options.stats->symbols += total;
+	}
+
+	if (decoder.failed() || (has_header && (total != header.original_size || checksum != header.checksum)))
+		return HuffmanStatus::HUFFMAN_READ_FAILED;
+	outfile.close();
+	if (!outfile)
+		return HuffmanStatus::OUTPUT_WRITE_FAILED;
+
+	return HuffmanStatus::OK;
+}
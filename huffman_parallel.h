@@ -0,0 +1,125 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_PARALLEL_H
+#define HUFFMAN_PARALLEL_H
+
+#include "huffman_stream.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Fixed set of worker threads running submitted tasks in FIFO order
+class ThreadPool
+{
+public:
+    // Start the workers, 0 starts one per hardware thread
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Function to queue a task for the next free worker
+    void submit(std::function<void()> task);
+
+    // Function to block until every submitted task has finished
+    void wait();
+
+    // Number of worker threads
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::vector<std::function<void()>> tasks; // Ring of queued tasks
+    size_t head;                              // First queued task in tasks
+    size_t queued;                            // Tasks queued and not taken by a worker
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+    size_t running; // Tasks taken by a worker and not finished yet
+    bool stopping;
+};
+
+// Function to code data[0, size) as independent blocks of options.block_size
+// bytes on options.threads workers. Every coded block (see encode_block) is
+// handed to sink in input order; at most two blocks per worker are in flight.
+// Returns false as soon as sink returns false.
+bool encode_blocks_parallel(const unsigned char *data, size_t size, const CompressionOptions &options,
+                            const std::function<bool(const std::vector<unsigned char> &)> &sink);
+
+// Function to decode every block listed in the index of the stream at data on
+// threads workers (0 for one per hardware thread), each straight into its
+// place in out, which holds the sum of the raw sizes. Returns false when a
+// block is malformed. Decoded blocks are counted into stats and reported to
+// progress, when given.
+bool decode_blocks_parallel(const unsigned char *data, size_t size, const std::vector<BlockIndexEntry> &index, unsigned char *out,
+                            unsigned threads, CompressionStats *stats = nullptr, const ProgressCallback &progress = ProgressCallback());
+
+// Decodes indexed block streams on workers kept from call to call, each with
+// its own DecodeScratch. A repeated table is rebuilt only when the worker's
+// last table is of another block. Workers take blocks in turn, so which
+// blocks a worker sees changes from call to call; once every worker has
+// decoded the largest block and tables of the streams it is given, decode()
+// does not allocate.
+class ParallelBlockDecoder
+{
+public:
+    // Start the workers, 0 starts one per hardware thread
+    explicit ParallelBlockDecoder(unsigned threads = 0);
+
+    // Function to decode every block listed in the index of the stream at
+    // data straight into its place in out (see decode_blocks_parallel),
+    // returns false when a block is malformed
+    bool decode(const unsigned char *data, size_t size, const std::vector<BlockIndexEntry> &index, unsigned char *out,
+                CompressionStats *stats = nullptr, const ProgressCallback &progress = ProgressCallback());
+
+    // Number of worker threads
+    unsigned threads() const { return pool.size(); }
+
+private:
+    struct Worker
+    {
+        DecodeScratch scratch;
+        size_t table_block = SIZE_MAX; // Block whose table scratch.table holds, SIZE_MAX for none
+    };
+
+    void run(size_t worker);
+
+    std::vector<Worker> workers;
+    std::vector<size_t> table_blocks; // Block storing the table each block is coded with
+    std::vector<uint64_t> out_offsets;
+
+    // The call in progress
+    const unsigned char *data;
+    size_t size;
+    const std::vector<BlockIndexEntry> *index;
+    unsigned char *out;
+    CompressionStats *stats;
+    const ProgressCallback *progress;
+    std::atomic<size_t> next; // Next block to take
+    std::atomic<bool> ok;
+    std::mutex mutex;         // Guards done, stats and progress
+    uint64_t total, done;
+
+    ThreadPool pool; // Last, so the workers stop before the state they use goes
+};
+
+// Function to compress data[0, size) into a Huffman file of independently
+// coded blocks behind a container header, coded concurrently and written in order
+HuffmanStatus compress_file_blocks(const unsigned char *data, size_t size, const std::string &huffman_name, const CompressionOptions &options);
+
+// Function to decompress a Huffman file of blocks. With a block index the
+// mapped file is decoded in parallel straight into a mapped, pre-sized
+// output file; without one it is decoded sequentially. Files with a
+// container header are checked against its size and checksum.
+HuffmanStatus decompress_file_blocks(const std::string &huffman_filename, const std::string &output_filename, const CompressionOptions &options);
+
+#endif // HUFFMAN_PARALLEL_H
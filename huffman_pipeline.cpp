@@ -0,0 +1,520 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_pipeline.h"
+#include "huffman_format.h"
+#include "huffman_mmap.h"
+
+#include <atomic>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HUFFMAN_IO_URING 1
+#endif
+#endif
+
+#ifdef HUFFMAN_IO_URING
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Submission and completion rings shared with the kernel, set up with the
+// raw system calls so no liburing is needed
+struct BlockReader::Ring
+{
+	int ring_fd = -1;
+	int file_fd = -1;
+	void *sq_map = MAP_FAILED;
+	void *cq_map = MAP_FAILED;
+	size_t sq_map_size = 0;
+	size_t cq_map_size = 0;
+	io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+	size_t sqes_size = 0;
+	unsigned *sq_tail = nullptr;
+	unsigned *sq_mask = nullptr;
+	unsigned *sq_array = nullptr;
+	unsigned *cq_head = nullptr;
+	unsigned *cq_tail = nullptr;
+	unsigned *cq_mask = nullptr;
+	io_uring_cqe *cqes = nullptr;
+
+	~Ring()
+	{
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqes_size);
+		if (cq_map != MAP_FAILED && cq_map != sq_map)
+			munmap(cq_map, cq_map_size);
+		if (sq_map != MAP_FAILED)
+			munmap(sq_map, sq_map_size);
+		if (ring_fd >= 0)
+			::close(ring_fd);
+		if (file_fd >= 0)
+			::close(file_fd);
+	}
+
+	// Function to create the rings for entries reads in flight
+	bool setup(unsigned entries)
+	{
+		io_uring_params params{};
+		ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (ring_fd < 0)
+			return false; // No io_uring in this kernel, or a sandbox refuses it
+
+		sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_map)
+			sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+
+		sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+		if (sq_map == MAP_FAILED)
+			return false;
+		cq_map = single_map ? sq_map : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_map == MAP_FAILED)
+			return false;
+		sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+		if (sqes == MAP_FAILED)
+			return false;
+
+		unsigned char *sq = static_cast<unsigned char *>(sq_map);
+		unsigned char *cq = static_cast<unsigned char *>(cq_map);
+		sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+		sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+		sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+		cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+		cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+		return supports_read();
+	}
+
+	// Function to ask the kernel whether it has IORING_OP_READ; kernels
+	// before 5.6 have io_uring but neither the read nor the probe, and fail
+	// every read with -EINVAL
+	bool supports_read()
+	{
+		constexpr unsigned PROBE_OPS = 256;
+		std::vector<unsigned char> buffer(sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op));
+		io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+		if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) < 0)
+			return false;
+		return probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+	}
+
+	// Function to queue one read and hand it to the kernel
+	bool submit(uint64_t user_data, unsigned char *buffer, size_t size, uint64_t offset)
+	{
+		const unsigned tail = *sq_tail; // Only this thread moves the tail
+		const unsigned index = tail & *sq_mask;
+		io_uring_sqe &sqe = sqes[index];
+		sqe = io_uring_sqe{};
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = file_fd;
+		sqe.addr = reinterpret_cast<uint64_t>(buffer);
+		sqe.len = static_cast<uint32_t>(size);
+		sqe.off = offset;
+		sqe.user_data = user_data;
+		sq_array[index] = index;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		long submitted;
+		do
+			submitted = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+		while (submitted < 0 && errno == EINTR);
+		return submitted == 1;
+	}
+
+	// Function to wait for the next completion
+	bool wait(uint64_t &user_data, int &result)
+	{
+		for (;;)
+		{
+			const unsigned head = *cq_head;
+			if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+			{
+				const io_uring_cqe &cqe = cqes[head & *cq_mask];
+				user_data = cqe.user_data;
+				result = cqe.res;
+				__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+			if (syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+				return false;
+		}
+	}
+};
+#else
+struct BlockReader::Ring
+{
+};
+#endif
+
+BlockReader::BlockReader(unsigned depth) : depth(std::max(depth, 1u)), length(0), requests(this->depth), in_flight(0)
+{
+}
+
+BlockReader::~BlockReader() = default;
+
+// Function to open the file, with an io_uring when one can be set up
+bool BlockReader::open(const std::string &path)
+{
+	drain();
+	ring.reset();
+	file.close();
+	queued.clear();
+	in_flight = 0;
+
+#ifdef HUFFMAN_IO_URING
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		::close(fd);
+		return false;
+	}
+	length = static_cast<uint64_t>(info.st_size);
+
+	std::unique_ptr<Ring> uring(new Ring());
+	uring->file_fd = fd;
+	if (uring->setup(depth))
+	{
+		ring = std::move(uring);
+		return true;
+	}
+#endif
+
+	// Plain reads; pipes and other streams have no size to seek to
+	file.open(path, std::ios::binary | std::ios::ate);
+	const std::streamoff end = file.tellg();
+	if (!file.is_open() || end < 0)
+		return false;
+	length = static_cast<uint64_t>(end);
+	return true;
+}
+
+// Function to queue a read
+bool BlockReader::submit(uint64_t tag, unsigned char *buffer, size_t size, uint64_t offset)
+{
+	Request &request = requests[tag % depth];
+	request = Request{tag, buffer, size, offset, 0};
+	if (ring == nullptr)
+	{
+		queued.push_back(tag);
+		return true;
+	}
+	return submit_request(request);
+}
+
+// Function to hand the rest of a request to the io_uring
+bool BlockReader::submit_request(const Request &request)
+{
+#ifdef HUFFMAN_IO_URING
+	if (!ring->submit(request.tag, request.buffer + request.done, request.size - request.done, request.offset + request.done))
+		return false;
+	++in_flight;
+	return true;
+#else
+	(void)request;
+	return false;
+#endif
+}
+
+// Function to wait for a whole read
+bool BlockReader::complete(uint64_t &tag)
+{
+	if (ring == nullptr)
+	{
+		if (queued.empty())
+			return false;
+		Request &request = requests[queued.front() % depth];
+		queued.pop_front();
+		file.seekg(static_cast<std::streamoff>(request.offset));
+		file.read(reinterpret_cast<char *>(request.buffer), static_cast<std::streamsize>(request.size));
+		tag = request.tag;
+		return file.gcount() == static_cast<std::streamsize>(request.size);
+	}
+
+#ifdef HUFFMAN_IO_URING
+	for (;;)
+	{
+		uint64_t user_data;
+		int result;
+		if (!ring->wait(user_data, result))
+			return false;
+		--in_flight;
+
+		Request &request = requests[user_data % depth];
+		if (result == -EINTR || result == -EAGAIN)
+			result = 0; // Nothing read, queue it again
+		else if (result <= 0)
+			return false; // A read error, or the file got shorter
+		request.done += static_cast<size_t>(result);
+		if (request.done == request.size)
+		{
+			tag = request.tag;
+			return true;
+		}
+		if (!submit_request(request))
+			return false; // Short read, ask for the rest
+	}
+#else
+	return false;
+#endif
+}
+
+// Function to wait for every read handed to the io_uring
+void BlockReader::drain()
+{
+#ifdef HUFFMAN_IO_URING
+	while (in_flight > 0)
+	{
+		uint64_t user_data;
+		int result;
+		if (!ring->wait(user_data, result))
+			return;
+		--in_flight;
+	}
+#endif
+}
+
+// States of a pipeline slot, which moves FREE -> READING -> CODING -> CODED -> FREE
+constexpr int SLOT_FREE = 0;
+constexpr int SLOT_READING = 1; // Owned by the reader
+constexpr int SLOT_CODING = 2;  // Owned by a worker
+constexpr int SLOT_CODED = 3;   // Waiting for the writer
+
+// Pipelined compression function
+HuffmanStatus compress_file_pipelined(const std::string &input_filename, const std::string &huffman_name, const CompressionOptions &options)
+{
+	CompressionOptions plain = options;
+	plain.pipeline = false;
+	if (options.block_size == 0)
+		return compress_path(input_filename, huffman_name, plain);
+
+	const size_t block_size = std::min(std::max<size_t>(options.block_size, 1), MAX_BLOCK_SIZE);
+	ThreadPool pool(options.threads);
+	const size_t window = 2 * static_cast<size_t>(pool.size()) + 2;
+
+	StageTimer open_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	BlockReader reader(static_cast<unsigned>(window));
+	if (!reader.open(input_filename))
+		return compress_path(input_filename, huffman_name, plain); // Not a regular file, or missing
+	std::ofstream outfile(huffman_name, std::ios::binary);
+	if (!outfile.is_open())
+		return HuffmanStatus::HUFFMAN_CREATE_FAILED;
+	open_timer.stop();
+
+	// The checksum is only known once every block is read, the header is rewritten with it at the end
+	const uint64_t size = reader.size();
+	const uint64_t block_count = (size + block_size - 1) / block_size;
+	FileHeader header;
+	header.flags = FILE_FLAG_CANONICAL | FILE_FLAG_BLOCKED | (options.interleaved ? FILE_FLAG_INTERLEAVED : 0);
+	header.original_size = size;
+	std::vector<unsigned char> prefix;
+	write_file_header(prefix, header);
+	outfile.write(reinterpret_cast<const char *>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+
+	// Ring of reusable block buffers, slot i % window holds block i from its read to its write
+	struct Slot
+	{
+		std::vector<unsigned char> input;
+		size_t size = 0;
+		std::vector<unsigned char> encoded;
+		BlockPlan plan;
+		CompressionStats stats; // Times of this block, only kept with options.stats
+		int state = SLOT_FREE;
+	};
+	std::vector<Slot> slots(static_cast<size_t>(std::min<uint64_t>(window, std::max<uint64_t>(block_count, 1))));
+	std::mutex mutex;
+	std::condition_variable slot_free;
+	std::condition_variable slot_coded;
+	bool failed = false; // Guarded by mutex
+	auto fail = [&]
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		failed = true;
+		slot_free.notify_all();
+		slot_coded.notify_all();
+	};
+
+	// Reader stage: keeps every free slot reading, and hands the blocks to the
+	// workers in input order as their reads finish
+	uint32_t checksum = 0;
+	CompressionStats reader_stats;
+	CompressionStats *read_stats = options.stats != nullptr ? &reader_stats : nullptr;
+	std::thread reader_thread([&]
+							  {
+		BlockPlan previous;
+		bool has_previous = false;
+		std::vector<bool> read_done(slots.size(), false);
+		std::vector<uint64_t> to_submit;
+		uint64_t next_read = 0, next_dispatch = 0;
+		while (next_dispatch < block_count)
+		{
+			to_submit.clear();
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (next_read == next_dispatch)
+					slot_free.wait(lock, [&]
+								   { return failed || slots[next_read % slots.size()].state == SLOT_FREE; });
+				if (failed)
+					return;
+				for (; next_read < block_count && slots[next_read % slots.size()].state == SLOT_FREE; ++next_read)
+				{
+					slots[next_read % slots.size()].state = SLOT_READING;
+					to_submit.push_back(next_read);
+				}
+			}
+
+			StageTimer read_timer(stat_field(read_stats, &CompressionStats::io_ns));
+			for (uint64_t k : to_submit)
+			{
+				Slot &slot = slots[k % slots.size()];
+				slot.size = static_cast<size_t>(std::min<uint64_t>(block_size, size - k * block_size));
+				slot.input.resize(slot.size);
+				if (!reader.submit(k, slot.input.data(), slot.size, k * block_size))
+				{
+					fail();
+					return;
+				}
+			}
+			uint64_t tag;
+			if (!reader.complete(tag))
+			{
+				fail();
+				return;
+			}
+			read_timer.stop();
+			read_done[tag % slots.size()] = true;
+
+			for (; next_dispatch < next_read && read_done[next_dispatch % slots.size()]; ++next_dispatch)
+			{
+				read_done[next_dispatch % slots.size()] = false;
+				Slot &slot = slots[next_dispatch % slots.size()];
+				StageTimer checksum_timer(stat_field(read_stats, &CompressionStats::io_ns));
+				checksum = crc32c(slot.input.data(), slot.size, checksum);
+				checksum_timer.stop();
+
+				// Table reuse depends on the block before, so those blocks are planned here in order
+				if (options.reuse_tables)
+				{
+					slot.stats = CompressionStats();
+					plan_block(slot.input.data(), slot.size, options, has_previous ? &previous : nullptr, slot.plan,
+							   options.stats != nullptr ? &slot.stats : nullptr);
+					if (slot.plan.type == BLOCK_TYPE_HUFFMAN)
+					{
+						previous = slot.plan;
+						has_previous = true;
+					}
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					slot.state = SLOT_CODING;
+				}
+
+				pool.submit([&, index = next_dispatch]
+							{
+								Slot &slot = slots[index % slots.size()];
+								CompressionStats *stats = options.stats != nullptr ? &slot.stats : nullptr;
+								if (!options.reuse_tables)
+								{
+									slot.stats = CompressionStats();
+									plan_block(slot.input.data(), slot.size, options, nullptr, slot.plan, stats);
+								}
+								slot.encoded.clear();
+								StageTimer code_timer(stat_field(stats, &CompressionStats::code_ns));
+								encode_block(slot.input.data(), slot.size, options, slot.plan, slot.encoded);
+								code_timer.stop();
+
+								std::lock_guard<std::mutex> lock(mutex);
+								slot.state = SLOT_CODED;
+								slot_coded.notify_all(); });
+			}
+		} });
+
+	// Writer stage, on this thread: the coded blocks go out in order and free their slots
+	std::vector<BlockIndexEntry> index;
+	uint64_t written = prefix.size();
+	bool ok = true;
+	for (uint64_t k = 0; k < block_count; ++k)
+	{
+		Slot &slot = slots[k % slots.size()];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			slot_coded.wait(lock, [&]
+							{ return failed || slot.state == SLOT_CODED; });
+			if (failed)
+			{
+				ok = false;
+				break;
+			}
+		}
+
+		index.push_back(BlockIndexEntry{written, static_cast<uint32_t>(slot.size)});
+		StageTimer write_timer(stat_field(options.stats, &CompressionStats::io_ns));
+		outfile.write(reinterpret_cast<const char *>(slot.encoded.data()), static_cast<std::streamsize>(slot.encoded.size()));
+		write_timer.stop();
+		written += slot.encoded.size();
+		if (options.stats != nullptr)
+		{
+			record_block_stats(slot.plan, slot.size, slot.stats);
+			merge_stats(*options.stats, slot.stats);
+		}
+		if (options.progress)
+			options.progress(k * block_size + slot.size, size);
+		if (!outfile)
+		{
+			fail();
+			ok = false;
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		slot.state = SLOT_FREE;
+		slot_free.notify_all();
+	}
+	reader_thread.join();
+	reader.drain(); // Reads still in flight after a failure write into the slots
+	pool.wait();
+	if (!ok)
+	{
+		bool read_failed;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			read_failed = failed && outfile;
+		}
+		return read_failed ? HuffmanStatus::INPUT_READ_FAILED : HuffmanStatus::HUFFMAN_WRITE_FAILED;
+	}
+
+	std::vector<unsigned char> end;
+	encode_end_block(end);
+	write_block_index(end, index);
+	StageTimer close_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	outfile.write(reinterpret_cast<const char *>(end.data()), static_cast<std::streamsize>(end.size()));
+	header.checksum = checksum;
+	prefix.clear();
+	write_file_header(prefix, header);
+	outfile.seekp(0);
+	outfile.write(reinterpret_cast<const char *>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+	outfile.close();
+	close_timer.stop();
+	if (options.stats != nullptr)
+	{
+		merge_stats(*options.stats, reader_stats);
+		options.stats->bytes_in += size;
+		options.stats->bytes_out += written + end.size();
+	}
+	if (!outfile)
+		return HuffmanStatus::HUFFMAN_WRITE_FAILED;
+
+	return HuffmanStatus::OK;
+}
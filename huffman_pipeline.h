@@ -0,0 +1,83 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_PIPELINE_H
+#define HUFFMAN_PIPELINE_H
+
+#include "huffman_parallel.h"
+
+#include <deque>
+#include <memory>
+
+// Reads whole blocks of a regular file into caller buffers, with up to depth
+// reads queued ahead of their use. On Linux the reads go through an io_uring
+// when the kernel allows one, so they run while the caller does other work;
+// elsewhere (when io_uring_setup is refused, or the kernel has no
+// IORING_OP_READ) a queued read is done with a plain file read when it is
+// completed.
+class BlockReader
+{
+public:
+    explicit BlockReader(unsigned depth);
+    ~BlockReader();
+
+    BlockReader(const BlockReader &) = delete;
+    BlockReader &operator=(const BlockReader &) = delete;
+
+    // Function to open the file, returns false when it cannot be opened or is
+    // not a regular file of known size
+    bool open(const std::string &path);
+
+    uint64_t size() const { return length; }
+
+    // Whether the reads go through an io_uring
+    bool asynchronous() const { return ring != nullptr; }
+
+    // Function to queue a read of size bytes at offset into buffer; tags of
+    // the reads in flight must differ modulo depth. Returns false on failure.
+    bool submit(uint64_t tag, unsigned char *buffer, size_t size, uint64_t offset);
+
+    // Function to wait for one queued read to finish in full and give its
+    // tag, returns false when a read failed or the file ended early
+    bool complete(uint64_t &tag);
+
+    // Function to wait until the kernel no longer writes into any buffer, for
+    // giving the buffers up after a failure
+    void drain();
+
+private:
+    // One queued read, indexed by tag modulo depth
+    struct Request
+    {
+        uint64_t tag;
+        unsigned char *buffer;
+        size_t size;
+        uint64_t offset;
+        size_t done; // Bytes read so far
+    };
+
+    struct Ring; // io_uring state, see huffman_pipeline.cpp
+
+    bool submit_request(const Request &request);
+
+    unsigned depth;
+    uint64_t length;
+    std::vector<Request> requests;
+    std::unique_ptr<Ring> ring;
+    size_t in_flight;            // Reads handed to the io_uring and not completed
+    std::ifstream file;          // Fallback reads
+    std::deque<uint64_t> queued; // Fallback reads in submission order
+};
+
+// Function to compress the file at input_filename into a Huffman file of
+// blocks (see compress_file_blocks, the output is the same) through three
+// overlapping stages: a reader filling a bounded ring of reusable block
+// buffers with BlockReader, options.threads workers coding the blocks, and
+// the calling thread writing them in order. Memory stays at 2 * threads + 2
+// blocks of input and their coded form, whatever the file size. Files that
+// are not regular (pipes) go the way of compress_path instead.
+HuffmanStatus compress_file_pipelined(const std::string &input_filename, const std::string &huffman_name, const CompressionOptions &options);
+
+#endif // HUFFMAN_PIPELINE_H
@@ -0,0 +1,243 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_STATIC_H
+#define HUFFMAN_STATIC_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Compile-time Huffman codes for tables known ahead, such as a shared
+// dictionary baked into firmware. Everything is built by constexpr code, so a
+//
+//   static constexpr auto code = static_code_from_lengths<256, 12>(LENGTHS);
+//   static_assert(code.valid, "LENGTHS is not a code of at most 12 bits");
+//
+// has no runtime construction and no heap; on targets whose constant data
+// stays in flash (ARM Cortex-M, ESP32, RP2040) the tables do not take RAM.
+// The codes are the same canonical codes build_canonical_codes assigns, so
+// the bitstreams match encode_data and decode_symbols for the same lengths.
+//
+// Footprint: N code lengths and N 16-bit codes, plus a single-level decode
+// table of 2^TableBits entries of one symbol and one length byte each
+// (8 KiB + 768 bytes for 256 symbols and 12-bit codes).
+
+template <size_t N, int TableBits>
+struct StaticCode
+{
+    static_assert(N >= 2 && N <= 0x10000, "symbols are 8 or 16 bits");
+    static_assert(TableBits >= 1 && TableBits <= 16, "codes and the decode index are at most 16 bits");
+
+    using Symbol = std::conditional_t<(N <= 256), uint8_t, uint16_t>;
+
+    // Entry of the decode table, indexed by the next TableBits bits
+    struct Entry
+    {
+        Symbol symbol = 0;
+        uint8_t length = 0; // 0 for prefixes no code starts with
+    };
+
+    std::array<uint8_t, N> lengths{};
+    std::array<uint16_t, N> codes{};
+    std::array<Entry, size_t(1) << TableBits> table{};
+    int max_length = 0;
+    bool valid = false; // The lengths form a prefix code of at most TableBits bits
+
+    // Function to assign the canonical codes of the lengths and fill the
+    // decode table, leaves valid false when they are not a usable code
+    constexpr void assign(const std::array<uint8_t, N> &code_lengths)
+    {
+        lengths = code_lengths;
+        std::array<uint32_t, TableBits + 1> length_count{};
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (lengths[i] > TableBits)
+                return;
+            if (lengths[i] != 0)
+                length_count[lengths[i]]++;
+            max_length = lengths[i] > max_length ? lengths[i] : max_length;
+        }
+
+        // Check the Kraft inequality and find the first code of every length
+        std::array<uint32_t, TableBits + 1> next_code{};
+        uint32_t code = 0;
+        for (int length = 1; length <= TableBits; ++length)
+        {
+            code = (code + length_count[length - 1]) << 1;
+            next_code[length] = code;
+            if (code + length_count[length] > (uint32_t(1) << length))
+                return;
+        }
+
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (lengths[i] == 0)
+                continue;
+            codes[i] = static_cast<uint16_t>(next_code[lengths[i]]++);
+
+            // Replicate the code over all the slots that start with it
+            const uint32_t first = uint32_t(codes[i]) << (TableBits - lengths[i]);
+            const uint32_t count = uint32_t(1) << (TableBits - lengths[i]);
+            for (uint32_t j = 0; j < count; ++j)
+            {
+                table[first + j].symbol = static_cast<Symbol>(i);
+                table[first + j].length = lengths[i];
+            }
+        }
+        valid = max_length > 0;
+    }
+
+    // Function to pack count symbols into out MSB first, zero padding the
+    // last byte; returns the bytes written, 0 when they do not fit capacity
+    size_t encode(const Symbol *in, size_t count, unsigned char *out, size_t capacity) const
+    {
+        uint32_t accumulator = 0; // Pending bits, right-aligned
+        int filled = 0;
+        size_t written = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            accumulator = (accumulator << lengths[in[i]]) | codes[in[i]];
+            filled += lengths[in[i]];
+            while (filled >= 8)
+            {
+                if (written == capacity)
+                    return 0;
+                filled -= 8;
+                out[written++] = static_cast<unsigned char>(accumulator >> filled);
+            }
+        }
+        if (filled > 0)
+        {
+            if (written == capacity)
+                return 0;
+            out[written++] = static_cast<unsigned char>(accumulator << (8 - filled));
+        }
+        return written;
+    }
+
+    // Function to decode exactly count symbols of in[0, size), returns the
+    // number decoded (less than count when the data is truncated or malformed)
+    size_t decode(const unsigned char *in, size_t size, Symbol *out, size_t count) const
+    {
+        uint32_t window = 0; // Next bits of the stream, left-aligned
+        int filled = 0;
+        size_t next = 0;
+        size_t produced = 0;
+        for (; produced < count; ++produced)
+        {
+            while (filled <= 24 && next < size)
+            {
+                window |= uint32_t(in[next++]) << (24 - filled);
+                filled += 8;
+            }
+
+            const Entry &entry = table[window >> (32 - TableBits)];
+            if (entry.length == 0 || entry.length > filled)
+                break; // Not a valid code, or it runs past the end of the data
+
+            out[produced] = entry.symbol;
+            window <<= entry.length;
+            filled -= entry.length;
+        }
+        return produced;
+    }
+};
+
+// Function to build a compile-time code from its code lengths
+template <size_t N, int TableBits>
+constexpr StaticCode<N, TableBits> static_code_from_lengths(const std::array<uint8_t, N> &lengths)
+{
+    StaticCode<N, TableBits> code;
+    code.assign(lengths);
+    return code;
+}
+
+// Function to compute optimal code lengths of at most max_length (1 to 16)
+// bits at compile time with package-merge, see
+// build_length_limited_code_lengths; a code that fits the limit anyway comes
+// out as the plain Huffman code. Returns all zeros when the used symbols
+// cannot fit max_length bits.
+template <size_t N>
+constexpr std::array<uint8_t, N> static_code_lengths(const std::array<unsigned int, N> &frequency, int max_length)
+{
+    constexpr int MAX_LEVELS = 16;
+    std::array<uint8_t, N> lengths{};
+
+    // Used symbols by increasing frequency
+    std::array<size_t, N> symbols{};
+    size_t n = 0;
+    for (size_t i = 0; i < N; ++i)
+    {
+        if (frequency[i] == 0)
+            continue;
+        size_t k = n++;
+        for (; k > 0 && frequency[symbols[k - 1]] > frequency[i]; --k)
+            symbols[k] = symbols[k - 1];
+        symbols[k] = i;
+    }
+    if (n == 0 || max_length < 1 || max_length > MAX_LEVELS || n > (size_t(1) << max_length))
+        return lengths;
+    if (n == 1)
+    {
+        lengths[symbols[0]] = 1; // A lone symbol still needs a decodable code
+        return lengths;
+    }
+
+    // leaf[level][k] tells whether item k of that level's list is a leaf
+    std::array<std::array<bool, 2 * N>, MAX_LEVELS> leaf{};
+    std::array<uint64_t, 2 * N> current{};
+    size_t current_size = n;
+    for (size_t k = 0; k < n; ++k)
+    {
+        current[k] = frequency[symbols[k]];
+        leaf[max_length - 1][k] = true;
+    }
+
+    for (int level = max_length - 2; level >= 0; --level)
+    {
+        std::array<uint64_t, 2 * N> merged{};
+        size_t merged_size = 0, next_leaf = 0, package = 0, package_count = current_size / 2;
+        while (next_leaf < n || package < package_count)
+        {
+            uint64_t package_weight = package < package_count ? current[2 * package] + current[2 * package + 1] : 0;
+            if (next_leaf < n && (package >= package_count || frequency[symbols[next_leaf]] <= package_weight))
+            {
+                leaf[level][merged_size] = true;
+                merged[merged_size++] = frequency[symbols[next_leaf++]];
+            }
+            else
+            {
+                merged[merged_size++] = package_weight;
+                ++package;
+            }
+        }
+        current = merged;
+        current_size = merged_size;
+    }
+
+    // Walk back down, the selected items of every list are always a prefix
+    size_t selected = 2 * n - 2;
+    for (int level = 0; level < max_length && selected > 0; ++level)
+    {
+        size_t leaves = 0;
+        for (size_t k = 0; k < selected; ++k)
+            leaves += leaf[level][k];
+        for (size_t k = 0; k < leaves; ++k)
+            lengths[symbols[k]]++;
+        selected = 2 * (selected - leaves);
+    }
+    return lengths;
+}
+
+// Function to build a compile-time code from symbol frequencies
+template <size_t N, int TableBits>
+constexpr StaticCode<N, TableBits> static_code_from_frequency(const std::array<unsigned int, N> &frequency)
+{
+    return static_code_from_lengths<N, TableBits>(static_code_lengths<N>(frequency, TableBits));
+}
+
+#endif // HUFFMAN_STATIC_H
@@ -0,0 +1,88 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_STATS_H
+#define HUFFMAN_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+// Counters and stage timings of compression and decompression calls, filled
+// when CompressionOptions::stats (or HuffmanDecoder::collect_stats) points
+// at one. Counters and times are added to, so one struct can sum many calls;
+// distinct_symbols and max_code_length keep the largest value seen. Times
+// of block files are summed over the worker threads, so they may exceed the
+// wall time of the call.
+struct CompressionStats
+{
+    uint64_t bytes_in = 0;     // Bytes read: the input, or the compressed data
+    uint64_t bytes_out = 0;    // Bytes written: the compressed data, or the output
+    uint64_t symbols = 0;      // Input bytes coded or decoded
+    int distinct_symbols = 0;  // Byte values in the data (the most of any one block for blocks), 0 when not known
+    int max_code_length = 0;   // Longest code, 0 when not known
+    uint64_t blocks = 0;       // Blocks of block files and streams
+    uint64_t histogram_ns = 0; // Counting byte frequencies
+    uint64_t tree_ns = 0;      // Building code lengths, codes and decode tables
+    uint64_t code_ns = 0;      // Encoding or decoding symbols; includes the tables for block decoding
+    uint64_t io_ns = 0;        // Reading and writing files, checksums
+};
+
+// Progress of a long call: bytes of input done so far, out of total (0 when
+// the total is not known, as for streams). Called after every block, and
+// once at the end; parallel decoders call it from their worker threads but
+// never concurrently.
+using ProgressCallback = std::function<void(uint64_t done, uint64_t total)>;
+
+// Adds the time from its construction to stop() (or its destruction) to
+// *sink; without a sink it does not even read the clock
+class StageTimer
+{
+public:
+    explicit StageTimer(uint64_t *sink) : sink(sink)
+    {
+        if (sink != nullptr)
+            start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() { stop(); }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+    void stop()
+    {
+        if (sink == nullptr)
+            return;
+        *sink += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        sink = nullptr;
+    }
+
+private:
+    uint64_t *sink;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Function to give the address of a stats field, nullptr without stats, for StageTimer
+inline uint64_t *stat_field(CompressionStats *stats, uint64_t CompressionStats::*field)
+{
+    return stats != nullptr ? &(stats->*field) : nullptr;
+}
+
+// Function to add the counters and times of part to total
+inline void merge_stats(CompressionStats &total, const CompressionStats &part)
+{
+    total.bytes_in += part.bytes_in;
+    total.bytes_out += part.bytes_out;
+    total.symbols += part.symbols;
+    total.distinct_symbols = part.distinct_symbols > total.distinct_symbols ? part.distinct_symbols : total.distinct_symbols;
+    total.max_code_length = part.max_code_length > total.max_code_length ? part.max_code_length : total.max_code_length;
+    total.blocks += part.blocks;
+    total.histogram_ns += part.histogram_ns;
+    total.tree_ns += part.tree_ns;
+    total.code_ns += part.code_ns;
+    total.io_ns += part.io_ns;
+}
+
+#endif // HUFFMAN_STATS_H
@@ -0,0 +1,808 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_stream.h"
+
+#include <cmath>
+
+// Function to count the bytes coded by write_code_lengths
+static size_t code_lengths_size(const CodeLengths &lengths)
+{
+	size_t bytes = 0;
+	for (int i = 0; i < NUM_CHAR; ++bytes)
+	{
+		if (lengths[i++] == 0)
+		{
+			while (i < NUM_CHAR && lengths[i] == 0)
+				++i;
+			++bytes; // Run size
+		}
+	}
+	return bytes;
+}
+
+// Function to count the block and pick its type and code lengths
+void plan_block(const unsigned char *data, size_t size, const CompressionOptions &options, const BlockPlan *previous, BlockPlan &plan,
+				CompressionStats *stats)
+{
+	StageTimer histogram_timer(stat_field(stats, &CompressionStats::histogram_ns));
+	init_frequency(plan.frequency);
+	sample_frequency(data, size, options.sample_step, plan.frequency);
+	histogram_timer.stop();
+
+	StageTimer tree_timer(stat_field(stats, &CompressionStats::tree_ns));
+	plan.type = BLOCK_TYPE_HUFFMAN;
+	plan.repeat = false;
+
+	// A run of one byte value is stored as that value
+	int distinct = 0;
+	for (int i = 0; i < NUM_CHAR; ++i)
+		distinct += plan.frequency[i] != 0;
+	if (distinct == 1)
+	{
+		plan.type = BLOCK_TYPE_RLE;
+		return;
+	}
+
+	uint64_t previous_bits = 0;
+	bool covered = options.reuse_tables && previous != nullptr;
+	if (covered)
+	{
+		// Cost under the previous code, which must cover every byte of the block
+		for (int i = 0; i < NUM_CHAR; ++i)
+		{
+			covered &= plan.frequency[i] == 0 || previous->lengths[i] != 0;
+			previous_bits += static_cast<uint64_t>(plan.frequency[i]) * previous->lengths[i];
+		}
+	}
+
+	if (covered)
+	{
+		// No prefix code beats the entropy, close enough to it skips building a fresh code
+		double entropy_bits = 0;
+		for (int i = 0; i < NUM_CHAR; ++i)
+		{
+			if (plan.frequency[i] != 0)
+				entropy_bits += plan.frequency[i] * std::log2(static_cast<double>(size) / plan.frequency[i]);
+		}
+		plan.repeat = previous_bits <= entropy_bits * (1 + TABLE_REUSE_SLACK);
+	}
+
+	// Block decoders only read codes the decode tables can hold
+	int max_length = options.max_code_length > 0 ? std::min(options.max_code_length, MAX_TABLE_CODE_LENGTH) : MAX_TABLE_CODE_LENGTH;
+	uint64_t payload_size;
+	if (plan.repeat)
+	{
+		plan.lengths = previous->lengths;
+		payload_size = (previous_bits + 7) / 8;
+	}
+	else
+	{
+		// Weigh a fresh code and the table it has to store against the previous code
+		build_code_lengths(plan.frequency, max_length, plan.lengths);
+		uint64_t fresh_bits = 0;
+		for (int i = 0; i < NUM_CHAR; ++i)
+			fresh_bits += static_cast<uint64_t>(plan.frequency[i]) * plan.lengths[i];
+		payload_size = (fresh_bits + 7) / 8 + code_lengths_size(plan.lengths);
+		if (covered && previous_bits <= (fresh_bits + 8 * code_lengths_size(plan.lengths)) * (1 + TABLE_REUSE_SLACK))
+		{
+			plan.lengths = previous->lengths;
+			plan.repeat = true;
+			payload_size = (previous_bits + 7) / 8;
+		}
+	}
+
+	// Text and other data whose bytes depend on the one before them shrink
+	// further under an order-1 model, whose tables the decoder must hold
+	if (options.order1)
+	{
+		uint64_t order1_size = (build_order1_model(data, size, plan.frequency, max_length, plan.model) + 7) / 8;
+		if (order1_size < payload_size)
+		{
+			plan.type = BLOCK_TYPE_ORDER1;
+			plan.repeat = false;
+			payload_size = order1_size;
+		}
+	}
+
+	// Data Huffman coding cannot shrink (already compressed, random) is stored as it is
+	if (payload_size >= size)
+	{
+		plan.type = BLOCK_TYPE_STORED;
+		plan.repeat = false;
+	}
+}
+
+// Function to count one planned block
+void record_block_stats(const BlockPlan &plan, size_t size, CompressionStats &stats)
+{
+	int distinct = 0;
+	for (int i = 0; i < NUM_CHAR; ++i)
+		distinct += plan.frequency[i] != 0;
+
+	int longest = 0;
+	if (plan.type == BLOCK_TYPE_HUFFMAN)
+		longest = *std::max_element(plan.lengths.begin(), plan.lengths.end());
+	for (int c = 0; plan.type == BLOCK_TYPE_ORDER1 && c < plan.model.context_count; ++c)
+		longest = std::max<int>(longest, *std::max_element(plan.model.lengths[c].begin(), plan.model.lengths[c].end()));
+
+	stats.symbols += size;
+	stats.blocks++;
+	stats.distinct_symbols = std::max(stats.distinct_symbols, distinct);
+	stats.max_code_length = std::max(stats.max_code_length, longest);
+}
+
+// Function to append one compressed block
+void encode_block(const unsigned char *data, size_t size, const CompressionOptions &options, std::vector<unsigned char> &out)
+{
+	BlockPlan plan;
+	plan_block(data, size, options, nullptr, plan);
+	encode_block(data, size, options, plan, out);
+}
+
+// Function to append one compressed block coded as planned
+void encode_block(const unsigned char *data, size_t size, const CompressionOptions &options, const BlockPlan &plan, std::vector<unsigned char> &out)
+{
+	if (size == 0)
+		return; // A raw size of 0 is the end block, empty blocks are left out
+
+	if (plan.type == BLOCK_TYPE_ORDER1)
+	{
+		size_t start = out.size();
+		write_le32(out, static_cast<uint32_t>(size));
+		write_le32(out, 0);
+		out.push_back(BLOCK_TYPE_ORDER1);
+		write_order1_model(out, plan.model);
+		encode_data_order1(data, size, plan.model, out);
+
+		uint32_t payload_size = static_cast<uint32_t>(out.size() - start - BLOCK_HEADER_SIZE);
+		for (int i = 0; i < 4; ++i)
+			out[start + 4 + i] = static_cast<unsigned char>(payload_size >> (8 * i));
+		return;
+	}
+	if (plan.type != BLOCK_TYPE_HUFFMAN)
+	{
+		// Stored blocks copy the bytes, RLE blocks hold their single byte value
+		size_t payload_size = 1 + (plan.type == BLOCK_TYPE_STORED ? size : 1);
+		write_le32(out, static_cast<uint32_t>(size));
+		write_le32(out, static_cast<uint32_t>(payload_size));
+		out.push_back(plan.type);
+		out.insert(out.end(), data, data + payload_size - 1);
+		return;
+	}
+
+	CodeTable codes{};
+	build_canonical_codes(plan.lengths, codes);
+
+	// Fixed header, the payload size is patched in once it is known
+	size_t start = out.size();
+	write_le32(out, static_cast<uint32_t>(size));
+	write_le32(out, 0);
+	out.reserve(out.size() + 1 + 2 * NUM_CHAR + static_cast<size_t>((encoded_bit_length(plan.frequency, codes) + 7) / 8) + 4);
+
+	// Interleaved streams have no single bit position per symbol, so no sync points
+	const uint32_t interval = options.sync_interval != 0 && !options.interleaved ? std::max(options.sync_interval, MIN_SYNC_INTERVAL) : 0;
+	out.push_back(BLOCK_TYPE_HUFFMAN | (interval != 0 ? BLOCK_FLAG_SYNC_POINTS : 0) | (options.interleaved ? BLOCK_FLAG_INTERLEAVED : 0) |
+				  (plan.repeat ? BLOCK_FLAG_REPEAT_TABLE : 0));
+	if (!plan.repeat)
+		write_code_lengths(out, plan.lengths);
+
+	if (options.interleaved)
+	{
+		encode_data_interleaved(data, size, codes, out);
+	}
+	else if (interval == 0)
+	{
+		encode_data(data, size, codes, out);
+	}
+	else
+	{
+		// Note the bit offset of every interval-th symbol while packing
+		std::vector<uint32_t> sync_points;
+		sync_points.reserve(size / interval);
+		BitWriter writer(out);
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (i != 0 && i % interval == 0)
+				sync_points.push_back(static_cast<uint32_t>(writer.bit_count()));
+			writer.put(codes[data[i]].bits, codes[data[i]].length);
+		}
+		writer.flush();
+
+		for (uint32_t point : sync_points)
+			write_le32(out, point);
+		write_le32(out, interval);
+	}
+
+	uint32_t payload_size = static_cast<uint32_t>(out.size() - start - BLOCK_HEADER_SIZE);
+	for (int i = 0; i < 4; ++i)
+		out[start + 4 + i] = static_cast<unsigned char>(payload_size >> (8 * i));
+}
+
+// Function to append the end of stream marker
+void encode_end_block(std::vector<unsigned char> &out)
+{
+	write_le32(out, 0);
+	write_le32(out, 0);
+}
+
+// Function to read the fixed header of a block
+bool read_block_header(const unsigned char *data, size_t size, uint32_t &raw_size, uint32_t &payload_size)
+{
+	if (size < BLOCK_HEADER_SIZE)
+		return false;
+
+	raw_size = read_le32(data);
+	payload_size = read_le32(data + 4);
+	return raw_size <= MAX_BLOCK_SIZE && payload_size <= 3 * MAX_BLOCK_SIZE;
+}
+
+// Parsed payload of a block
+struct BlockView
+{
+	uint8_t type;				  // Block type from the mode byte
+	uint32_t raw_size;
+	size_t consumed;			  // Header plus payload
+	const unsigned char *packed;  // Packed symbols, the stored bytes or the RLE byte value
+	size_t packed_size;
+	const unsigned char *sync;	  // Sync point table, nullptr when there is none
+	uint32_t sync_interval;
+	bool interleaved;			  // Packed symbols are split over interleaved streams
+};
+
+// Function to check the layout of the block at data and build its decode
+// table into table, which blocks repeating the previous table use as it is
+static bool parse_block(const unsigned char *data, size_t size, BlockView &view, DecodeTable &table)
+{
+	uint32_t payload_size;
+	if (!read_block_header(data, size, view.raw_size, payload_size) || size - BLOCK_HEADER_SIZE < payload_size || payload_size == 0)
+		return false;
+
+	const unsigned char *payload = data + BLOCK_HEADER_SIZE;
+	const unsigned char mode = payload[0];
+	view.type = mode & 0x0F;
+	view.consumed = BLOCK_HEADER_SIZE + payload_size;
+	view.sync = nullptr;
+	view.sync_interval = 0;
+	view.interleaved = false;
+
+	// Stored, RLE and order-1 blocks take no flags and leave the table to the blocks after them
+	if (view.type == BLOCK_TYPE_STORED || view.type == BLOCK_TYPE_RLE || view.type == BLOCK_TYPE_ORDER1)
+	{
+		view.packed = payload + 1;
+		view.packed_size = payload_size - 1;
+		if (view.type == BLOCK_TYPE_ORDER1)
+			return (mode & 0xF0) == 0;
+		return (mode & 0xF0) == 0 && view.packed_size == (view.type == BLOCK_TYPE_STORED ? view.raw_size : 1);
+	}
+	if (view.type != BLOCK_TYPE_HUFFMAN)
+		return false;
+
+	size_t lengths_size = 0;
+	if (mode & BLOCK_FLAG_REPEAT_TABLE)
+	{
+		if (table.entries.empty())
+			return false; // No previous table to repeat
+	}
+	else
+	{
+		CodeLengths lengths;
+		lengths_size = read_code_lengths(payload + 1, payload_size - 1, lengths);
+		CodeTable codes{};
+		if (lengths_size == 0 || !build_canonical_codes(lengths, codes) || !build_decode_table(codes, table))
+		{
+			table.entries.clear();
+			return false;
+		}
+	}
+
+	view.packed = payload + 1 + lengths_size;
+	view.packed_size = payload_size - 1 - lengths_size;
+	view.interleaved = (mode & BLOCK_FLAG_INTERLEAVED) != 0;
+
+	if ((mode & BLOCK_FLAG_SYNC_POINTS) && view.interleaved)
+		return false;
+	if (mode & BLOCK_FLAG_SYNC_POINTS)
+	{
+		// The table sits at the end of the payload, its size follows from the interval
+		if (view.packed_size < 4)
+			return false;
+		view.sync_interval = read_le32(payload + payload_size - 4);
+		if (view.sync_interval < MIN_SYNC_INTERVAL)
+			return false;
+
+		size_t table_size = 4 * static_cast<size_t>(view.raw_size > 0 ? (view.raw_size - 1) / view.sync_interval : 0) + 4;
+		if (view.packed_size < table_size)
+			return false;
+		view.packed_size -= table_size;
+		view.sync = view.packed + view.packed_size;
+	}
+	return true;
+}
+
+// Function to decode the first count symbols of an order-1 block, whose
+// model leads its packed data
+static bool decode_order1_block(const BlockView &view, unsigned char *out, size_t count, std::vector<DecodeTable> &tables)
+{
+	Order1Model model;
+	size_t model_size = read_order1_model(view.packed, view.packed_size, model);
+	if (model_size == 0 || !build_order1_tables(model, tables))
+		return false;
+
+	return decode_symbols_order1(view.packed + model_size, view.packed_size - model_size, model, tables, out, count) == count;
+}
+
+// Function to decode one block into a vector
+size_t decode_block(const unsigned char *data, size_t size, std::vector<unsigned char> &out)
+{
+	uint32_t raw_size, payload_size;
+	if (!read_block_header(data, size, raw_size, payload_size))
+		return 0;
+
+	out.resize(raw_size);
+	return decode_block(data, size, out.data(), raw_size);
+}
+
+// Function to decode one block into a buffer of its raw size
+size_t decode_block(const unsigned char *data, size_t size, unsigned char *out, size_t raw_size)
+{
+	DecodeTable table;
+	return decode_block(data, size, out, raw_size, table);
+}
+
+// Function to decode one block, carrying the decode table from block to block
+size_t decode_block(const unsigned char *data, size_t size, unsigned char *out, size_t raw_size, DecodeTable &table)
+{
+	DecodeScratch scratch;
+	std::swap(scratch.table, table);
+	size_t consumed = decode_block(data, size, out, raw_size, scratch);
+	std::swap(scratch.table, table);
+	return consumed;
+}
+
+// Function to decode one block with reusable tables
+size_t decode_block(const unsigned char *data, size_t size, unsigned char *out, size_t raw_size, DecodeScratch &scratch)
+{
+	DecodeTable &table = scratch.table;
+	BlockView view;
+	if (!parse_block(data, size, view, table) || view.raw_size != raw_size)
+		return 0;
+
+	if (view.type == BLOCK_TYPE_STORED)
+	{
+		std::memcpy(out, view.packed, raw_size);
+		return view.consumed;
+	}
+	if (view.type == BLOCK_TYPE_RLE)
+	{
+		std::memset(out, view.packed[0], raw_size);
+		return view.consumed;
+	}
+	if (view.type == BLOCK_TYPE_ORDER1)
+		return decode_order1_block(view, out, raw_size, scratch.order1_tables) ? view.consumed : 0;
+
+	size_t decoded = view.interleaved ? decode_symbols_interleaved(view.packed, view.packed_size, table, out, raw_size)
+									  : decode_symbols(view.packed, view.packed_size, table, out, raw_size);
+	if (decoded != raw_size)
+		return 0;
+
+	return view.consumed;
+}
+
+// Function to check the repeat flag of a block
+bool block_repeats_table(const unsigned char *data, size_t size)
+{
+	return size > BLOCK_HEADER_SIZE && (data[BLOCK_HEADER_SIZE] & BLOCK_FLAG_REPEAT_TABLE) != 0;
+}
+
+// Function to tell whether a block stores code lengths
+bool block_stores_table(const unsigned char *data, size_t size)
+{
+	return size > BLOCK_HEADER_SIZE && (data[BLOCK_HEADER_SIZE] & 0x0F) == BLOCK_TYPE_HUFFMAN && !block_repeats_table(data, size);
+}
+
+// Function to build the decode table stored in a block, only its header and
+// code lengths need to be present
+bool read_block_table(const unsigned char *data, size_t size, DecodeTable &table)
+{
+	if (!block_stores_table(data, size))
+		return false;
+
+	CodeLengths lengths;
+	CodeTable codes{};
+	return read_code_lengths(data + BLOCK_HEADER_SIZE + 1, size - BLOCK_HEADER_SIZE - 1, lengths) != 0 && build_canonical_codes(lengths, codes) &&
+		   build_decode_table(codes, table);
+}
+
+// Function to find the block whose table the indexed block k is coded with
+size_t find_table_block(const unsigned char *data, size_t size, const std::vector<BlockIndexEntry> &index, size_t k)
+{
+	while (k > 0 && !block_stores_table(data + index[k].offset, size - static_cast<size_t>(index[k].offset)))
+		--k;
+	return k;
+}
+
+// Function to decode bytes [begin, end) of one block
+bool decode_block_range(const unsigned char *data, size_t size, size_t begin, size_t end, unsigned char *out)
+{
+	DecodeTable table;
+	return decode_block_range(data, size, begin, end, out, table);
+}
+
+// Function to decode bytes [begin, end) of one block, carrying the decode table
+bool decode_block_range(const unsigned char *data, size_t size, size_t begin, size_t end, unsigned char *out, DecodeTable &table)
+{
+	DecodeScratch scratch;
+	std::swap(scratch.table, table);
+	bool ok = decode_block_range(data, size, begin, end, out, scratch);
+	std::swap(scratch.table, table);
+	return ok;
+}
+
+// Function to decode bytes [begin, end) of one block with reusable tables and buffers
+bool decode_block_range(const unsigned char *data, size_t size, size_t begin, size_t end, unsigned char *out, DecodeScratch &scratch)
+{
+	DecodeTable &table = scratch.table;
+	BlockView view;
+	if (!parse_block(data, size, view, table) || begin > end || end > view.raw_size)
+		return false;
+	if (begin == end)
+		return true;
+
+	if (view.type == BLOCK_TYPE_STORED)
+	{
+		std::memcpy(out, view.packed + begin, end - begin);
+		return true;
+	}
+	if (view.type == BLOCK_TYPE_RLE)
+	{
+		std::memset(out, view.packed[0], end - begin);
+		return true;
+	}
+	if (view.type == BLOCK_TYPE_ORDER1)
+	{
+		// Every symbol's table depends on the one before it, so decode from the block start
+		std::vector<unsigned char> &decoded = scratch.skipped;
+		decoded.resize(end);
+		if (!decode_order1_block(view, decoded.data(), end, scratch.order1_tables))
+			return false;
+		std::copy(decoded.begin() + begin, decoded.end(), out);
+		return true;
+	}
+
+	// Restart from the last sync point at or before begin
+	size_t start_symbol = 0;
+	uint64_t start_bit = 0;
+	if (view.sync != nullptr && begin >= view.sync_interval)
+	{
+		size_t point = begin / view.sync_interval;
+		start_symbol = point * view.sync_interval;
+		start_bit = read_le32(view.sync + 4 * (point - 1));
+		if (start_bit / 8 >= view.packed_size)
+			return false;
+	}
+
+	// Decode only up to end, the skipped prefix lands in scratch space
+	std::vector<unsigned char> &decoded = scratch.skipped;
+	decoded.resize(end - start_symbol);
+	size_t byte = static_cast<size_t>(start_bit / 8);
+	size_t count = view.interleaved ? decode_symbols_interleaved(view.packed, view.packed_size, table, decoded.data(), decoded.size())
+									: decode_symbols(view.packed + byte, view.packed_size - byte, table, decoded.data(), decoded.size(), static_cast<int>(start_bit % 8));
+	if (count != decoded.size())
+		return false;
+
+	std::copy(decoded.begin() + (begin - start_symbol), decoded.end(), out);
+	return true;
+}
+
+// Function to decode bytes [begin, end) of a whole stream held in memory
+bool decompress_range(const unsigned char *data, size_t size, uint64_t begin, uint64_t end, std::vector<unsigned char> &out)
+{
+	std::vector<BlockIndexEntry> index;
+	if (begin > end || !read_block_index(data, size, index))
+		return false;
+
+	out.resize(static_cast<size_t>(end - begin));
+	DecodeScratch scratch;
+	bool have_table = false; // scratch.table holds the table of the last block storing one
+	uint64_t block_start = 0;
+	for (size_t k = 0; k < index.size(); ++k)
+	{
+		const BlockIndexEntry &block = index[k];
+		uint64_t block_end = block_start + block.raw_size;
+		if (block_end > begin && block_start < end)
+		{
+			// A block repeating a table before any block of the range stored one
+			// (the range may start in a stored, RLE or order-1 block) reads it
+			// from the earlier block that stores it
+			const unsigned char *block_data = data + block.offset;
+			const size_t block_size = size - static_cast<size_t>(block.offset);
+			if (!have_table && block_repeats_table(block_data, block_size))
+			{
+				const BlockIndexEntry &source = index[find_table_block(data, size, index, k)];
+				if (!read_block_table(data + source.offset, size - static_cast<size_t>(source.offset), scratch.table))
+					return false;
+				have_table = true;
+			}
+			have_table = have_table || block_stores_table(block_data, block_size);
+
+			uint64_t first_byte = std::max(begin, block_start);
+			uint64_t last_byte = std::min(end, block_end);
+			if (!decode_block_range(data + block.offset, size - static_cast<size_t>(block.offset), static_cast<size_t>(first_byte - block_start),
+									static_cast<size_t>(last_byte - block_start), out.data() + (first_byte - begin), scratch))
+				return false;
+		}
+		block_start = block_end;
+	}
+	return end <= block_start;
+}
+
+// Function to decode bytes [begin, end) of a Huffman file, reading only the
+// index and the blocks that overlap the range
+bool decompress_file_range(const std::string &huffman_filename, uint64_t begin, uint64_t end, std::vector<unsigned char> &out)
+{
+	std::ifstream infile(huffman_filename, std::ios::binary);
+	if (!infile.is_open() || begin > end)
+		return false;
+
+	// Trailer, then the index in front of it
+	infile.seekg(0, std::ios::end);
+	uint64_t file_size = static_cast<uint64_t>(infile.tellg());
+	if (file_size < 8 + BLOCK_HEADER_SIZE)
+		return false;
+
+	unsigned char trailer[8];
+	infile.seekg(static_cast<std::streamoff>(file_size - 8));
+	infile.read(reinterpret_cast<char *>(trailer), 8);
+	uint64_t block_count = read_le32(trailer);
+	if (!infile || read_le32(trailer + 4) != BLOCK_INDEX_MAGIC || block_count * BLOCK_INDEX_ENTRY_SIZE + 8 + BLOCK_HEADER_SIZE > file_size)
+		return false;
+
+	// The index sits between the end block and the trailer
+	uint64_t index_start = file_size - 8 - block_count * BLOCK_INDEX_ENTRY_SIZE;
+	std::vector<unsigned char> entries(static_cast<size_t>(block_count * BLOCK_INDEX_ENTRY_SIZE));
+	infile.seekg(static_cast<std::streamoff>(index_start));
+	infile.read(reinterpret_cast<char *>(entries.data()), static_cast<std::streamsize>(entries.size()));
+
+	std::vector<BlockIndexEntry> index;
+	if (!infile || !parse_block_index(entries.data(), static_cast<size_t>(block_count), index_start, index))
+		return false;
+
+	// A block runs up to the next one, the last one up to the end block
+	auto read_block = [&](size_t k, std::vector<unsigned char> &compressed)
+	{
+		uint64_t next = k + 1 < index.size() ? index[k + 1].offset : index_start - BLOCK_HEADER_SIZE;
+		compressed.resize(static_cast<size_t>(next - index[k].offset));
+		infile.seekg(static_cast<std::streamoff>(index[k].offset));
+		infile.read(reinterpret_cast<char *>(compressed.data()), static_cast<std::streamsize>(compressed.size()));
+		return static_cast<bool>(infile);
+	};
+
+	out.resize(static_cast<size_t>(end - begin));
+	std::vector<unsigned char> compressed;
+	DecodeScratch scratch;
+	bool have_table = false; // scratch.table holds the table of the last block storing one
+	uint64_t block_start = 0;
+	for (size_t k = 0; k < index.size(); ++k)
+	{
+		const BlockIndexEntry &block = index[k];
+		uint64_t block_end = block_start + block.raw_size;
+		if (block_end > begin && block_start < end)
+		{
+			if (!read_block(k, compressed))
+				return false;
+
+			// A block repeating a table before any block of the range stored
+			// one reads it from the earlier block storing it, walking back
+			// over the mode bytes of the blocks in between
+			if (!have_table && block_repeats_table(compressed.data(), compressed.size()))
+			{
+				std::vector<unsigned char> source;
+				size_t j = k;
+				do
+				{
+					if (j == 0 || !read_block(--j, source))
+						return false;
+				} while (!block_stores_table(source.data(), source.size()));
+				if (!read_block_table(source.data(), source.size(), scratch.table))
+					return false;
+				have_table = true;
+			}
+			have_table = have_table || block_stores_table(compressed.data(), compressed.size());
+
+			uint64_t first_byte = std::max(begin, block_start);
+			uint64_t last_byte = std::min(end, block_end);
+			if (!decode_block_range(compressed.data(), compressed.size(), static_cast<size_t>(first_byte - block_start),
+									static_cast<size_t>(last_byte - block_start), out.data() + (first_byte - begin), scratch))
+				return false;
+		}
+		block_start = block_end;
+	}
+	return end <= block_start;
+}
+
+// Function to append the block index
+void write_block_index(std::vector<unsigned char> &out, const std::vector<BlockIndexEntry> &index)
+{
+	for (const BlockIndexEntry &entry : index)
+	{
+		write_le64(out, entry.offset);
+		write_le32(out, entry.raw_size);
+	}
+	write_le32(out, static_cast<uint32_t>(index.size()));
+	write_le32(out, BLOCK_INDEX_MAGIC);
+}
+
+// Function to load the block index from the end of the stream
+bool read_block_index(const unsigned char *data, size_t size, std::vector<BlockIndexEntry> &index)
+{
+	if (size < 8 || read_le32(data + size - 4) != BLOCK_INDEX_MAGIC)
+		return false;
+
+	uint64_t block_count = read_le32(data + size - 8);
+	if (block_count * BLOCK_INDEX_ENTRY_SIZE + 8 + BLOCK_HEADER_SIZE > size)
+		return false;
+
+	size_t index_start = size - 8 - static_cast<size_t>(block_count) * BLOCK_INDEX_ENTRY_SIZE;
+	return parse_block_index(data + index_start, static_cast<size_t>(block_count), index_start, index);
+}
+
+// Function to parse the index entries, every block must start in order and
+// before the end block that precedes the index at index_start
+bool parse_block_index(const unsigned char *entries, size_t block_count, uint64_t index_start, std::vector<BlockIndexEntry> &index)
+{
+	if (index_start < BLOCK_HEADER_SIZE)
+		return false;
+
+	const uint64_t end_block = index_start - BLOCK_HEADER_SIZE;
+	uint64_t next_offset = 0;
+	index.resize(block_count);
+	for (BlockIndexEntry &block : index)
+	{
+		block.offset = read_le64(entries);
+		block.raw_size = read_le32(entries + 8);
+		entries += BLOCK_INDEX_ENTRY_SIZE;
+		if (block.offset < next_offset || block.offset >= end_block || end_block - block.offset < BLOCK_HEADER_SIZE || block.raw_size > MAX_BLOCK_SIZE)
+			return false;
+		next_offset = block.offset + BLOCK_HEADER_SIZE;
+	}
+	return true;
+}
+
+StreamEncoder::StreamEncoder(std::ostream &out, size_t block_size, const CompressionOptions &options)
+	: out(out), block_size(std::min(std::max<size_t>(block_size, 1), MAX_BLOCK_SIZE)), options(options), has_previous(false), written(0), consumed(0), finished(false)
+{
+	pending.reserve(this->block_size);
+}
+
+// Function to add input, coding every block as soon as it is full
+bool StreamEncoder::write(const unsigned char *data, size_t size)
+{
+	if (finished)
+		return false;
+
+	while (size > 0)
+	{
+		size_t take = std::min(size, block_size - pending.size());
+		pending.insert(pending.end(), data, data + take);
+		data += take;
+		size -= take;
+
+		if (pending.size() == block_size && !flush_block())
+			return false;
+	}
+	return static_cast<bool>(out);
+}
+
+// Function to code the last partial block and write the end marker
+bool StreamEncoder::finish()
+{
+	if (finished)
+		return static_cast<bool>(out);
+	finished = true;
+
+	if (!pending.empty() && !flush_block())
+		return false;
+
+	encoded.clear();
+	encode_end_block(encoded);
+	write_block_index(encoded, index);
+	StageTimer io_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	out.write(reinterpret_cast<const char *>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+	out.flush();
+	io_timer.stop();
+	if (options.stats != nullptr)
+		options.stats->bytes_out += encoded.size();
+	return static_cast<bool>(out);
+}
+
+// Function to code and write the pending block
+bool StreamEncoder::flush_block()
+{
+	encoded.clear();
+	BlockPlan plan;
+	plan_block(pending.data(), pending.size(), options, has_previous ? &previous : nullptr, plan, options.stats);
+	StageTimer code_timer(stat_field(options.stats, &CompressionStats::code_ns));
+	encode_block(pending.data(), pending.size(), options, plan, encoded);
+	code_timer.stop();
+	if (options.stats != nullptr)
+		record_block_stats(plan, pending.size(), *options.stats);
+	if (plan.type == BLOCK_TYPE_HUFFMAN)
+	{
+		previous = plan;
+		has_previous = true;
+	}
+	index.push_back(BlockIndexEntry{written, static_cast<uint32_t>(pending.size())});
+	consumed += pending.size();
+	pending.clear();
+
+	StageTimer io_timer(stat_field(options.stats, &CompressionStats::io_ns));
+	out.write(reinterpret_cast<const char *>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+	io_timer.stop();
+	written += encoded.size();
+	if (options.stats != nullptr)
+	{
+		options.stats->bytes_in += index.back().raw_size;
+		options.stats->bytes_out += encoded.size();
+	}
+	if (options.progress)
+		options.progress(consumed, 0);
+	return static_cast<bool>(out);
+}
+
+StreamDecoder::StreamDecoder(std::istream &in) : in(in), position(0), done(false), error(false)
+{
+}
+
+// Function to hand out decoded bytes, decoding the next block when needed
+size_t StreamDecoder::read(unsigned char *data, size_t size)
+{
+	size_t produced = 0;
+	while (produced < size)
+	{
+		if (position == decoded.size() && !next_block())
+			break;
+
+		size_t take = std::min(size - produced, decoded.size() - position);
+		std::copy(decoded.begin() + position, decoded.begin() + position + take, data + produced);
+		position += take;
+		produced += take;
+	}
+	return produced;
+}
+
+// Function to read and decode the next block, returns false at the end of the stream
+bool StreamDecoder::next_block()
+{
+	if (done || error)
+		return false;
+
+	compressed.resize(BLOCK_HEADER_SIZE);
+	in.read(reinterpret_cast<char *>(compressed.data()), BLOCK_HEADER_SIZE);
+
+	uint32_t raw_size, payload_size;
+	if (!in || !read_block_header(compressed.data(), compressed.size(), raw_size, payload_size))
+	{
+		error = true;
+		return false;
+	}
+	if (raw_size == 0)
+	{
+		done = true;
+		return false;
+	}
+
+	compressed.resize(BLOCK_HEADER_SIZE + payload_size);
+	in.read(reinterpret_cast<char *>(compressed.data() + BLOCK_HEADER_SIZE), payload_size);
+	decoded.resize(raw_size);
+	if (!in || decode_block(compressed.data(), compressed.size(), decoded.data(), raw_size, scratch) == 0)
+	{
+		error = true;
+		return false;
+	}
+
+	position = 0;
+	return true;
+}
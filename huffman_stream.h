@@ -0,0 +1,246 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_STREAM_H
+#define HUFFMAN_STREAM_H
+
+#include "huffman_compression.h"
+#include "huffman_order1.h"
+
+// Input bytes coded per block unless the caller asks for another size
+constexpr size_t DEFAULT_BLOCK_SIZE = size_t(1) << 20;
+
+// Largest block the decoder accepts, bounds its memory on corrupt input
+constexpr size_t MAX_BLOCK_SIZE = size_t(1) << 26;
+
+// Size of the fixed part of a block: raw size and payload size
+constexpr size_t BLOCK_HEADER_SIZE = 8;
+
+// Marks the block index at the very end of a stream ("AHIX")
+constexpr uint32_t BLOCK_INDEX_MAGIC = 0x58494841;
+
+// Size of one block index entry: offset and raw size
+constexpr size_t BLOCK_INDEX_ENTRY_SIZE = 12;
+
+// Block types, stored in the low nibble of the mode byte that starts the payload
+constexpr uint8_t BLOCK_TYPE_HUFFMAN = 0x00;
+constexpr uint8_t BLOCK_TYPE_STORED = 0x01; // The raw bytes, for data Huffman coding would not shrink
+constexpr uint8_t BLOCK_TYPE_RLE = 0x02;    // One byte value repeated raw_size times
+constexpr uint8_t BLOCK_TYPE_ORDER1 = 0x03; // Order-1 model and packed data, see huffman_order1.h
+
+// Block flags, stored in the high nibble of the mode byte
+constexpr uint8_t BLOCK_FLAG_SYNC_POINTS = 0x10;
+constexpr uint8_t BLOCK_FLAG_INTERLEAVED = 0x20;
+constexpr uint8_t BLOCK_FLAG_REPEAT_TABLE = 0x40;
+
+// How much larger than the best estimate a block may code under the previous
+// block's table and still repeat it
+constexpr double TABLE_REUSE_SLACK = 1.0 / 64;
+
+// Smallest distance between two sync points, bounds the size of their table
+constexpr uint32_t MIN_SYNC_INTERVAL = 64;
+
+// Block layout, every block carries its own code table:
+//   uint32 raw_size      bytes of input coded in the block, 0 ends the stream
+//   uint32 payload_size  bytes that follow the fixed header
+//   uint8 mode           block type and flags; stored blocks continue with
+//                        their raw bytes, RLE blocks with their byte value,
+//                        order-1 blocks with their serialized model and
+//                        packed data; none of them takes flags
+//   code lengths         run-length coded, see write_code_lengths; left out
+//                        with BLOCK_FLAG_REPEAT_TABLE, the block is then coded
+//                        with the table of the closest Huffman block before
+//                        it that stores one
+//   packed data          canonical codes, MSB first, zero padded; with
+//                        BLOCK_FLAG_INTERLEAVED the jump table and streams
+//                        of encode_data_interleaved
+//   sync points          with BLOCK_FLAG_SYNC_POINTS only: uint32 bit offset
+//                        of every interval-th symbol, then uint32 interval
+//
+// The end block is followed by the block index, so readers can find and
+// decode any block without scanning the ones before it:
+//   per block: uint64 offset of the block from the start of the stream,
+//              uint32 raw_size
+//   uint32 block_count
+//   uint32 BLOCK_INDEX_MAGIC
+
+// Position of one block in a stream
+struct BlockIndexEntry
+{
+    uint64_t offset;   // Offset of the block header from the start of the stream
+    uint32_t raw_size; // Decoded size of the block
+};
+
+// Frequencies, type and code chosen for one block
+struct BlockPlan
+{
+    std::array<unsigned int, NUM_CHAR> frequency;
+    CodeLengths lengths;
+    uint8_t type = BLOCK_TYPE_HUFFMAN;
+    bool repeat = false; // Coded with the previous block's lengths, which are not stored again
+    Order1Model model;   // Context tables of an order-1 block
+};
+
+// Function to count data[0, size) and choose its type and code lengths. A
+// single byte value makes an RLE block, and data whose Huffman payload would
+// not be smaller than the data itself is stored. With
+// options.reuse_tables and a previous block whose code covers the block, the
+// previous lengths are repeated when they cost at most TABLE_REUSE_SLACK
+// more than the entropy (no fresh code is built then) or than a fresh code
+// plus its stored table. With options.order1 the block is coded with an
+// order-1 model when that, tables included, comes out smaller. The time
+// spent counting and building codes is added to stats when given one.
+void plan_block(const unsigned char *data, size_t size, const CompressionOptions &options, const BlockPlan *previous, BlockPlan &plan,
+                CompressionStats *stats = nullptr);
+
+// Function to add one planned block of size bytes to the counters of stats
+void record_block_stats(const BlockPlan &plan, size_t size, CompressionStats &stats);
+
+// Function to append one compressed block holding data[0, size) to out,
+// nothing when size is 0
+void encode_block(const unsigned char *data, size_t size, const CompressionOptions &options, std::vector<unsigned char> &out);
+
+// Function to append one compressed block coded as planned by plan_block
+void encode_block(const unsigned char *data, size_t size, const CompressionOptions &options, const BlockPlan &plan, std::vector<unsigned char> &out);
+
+// Function to append the block that marks the end of a stream
+void encode_end_block(std::vector<unsigned char> &out);
+
+// Function to read the raw and payload size of the block at data, returns
+// false when the header is incomplete or out of bounds
+bool read_block_header(const unsigned char *data, size_t size, uint32_t &raw_size, uint32_t &payload_size);
+
+// Reusable memory of block decoding: the decode table carried from block to
+// block, the tables of order-1 blocks and the buffer of symbols a range
+// decode skips. Everything keeps its capacity, so once a scratch has decoded
+// the largest block of its stream, decoding with it does not allocate. It is
+// not shared between threads; parallel decoding keeps one per worker.
+struct DecodeScratch
+{
+    DecodeTable table;                       // Table of the last Huffman block, for blocks repeating it
+    std::vector<DecodeTable> order1_tables;  // Tables of the last order-1 block
+    std::vector<unsigned char> skipped;      // Symbols decoded ahead of a range
+};
+
+// Function to decode the block at data into out (resized to the raw size),
+// returns the bytes consumed or 0 when the block is malformed
+size_t decode_block(const unsigned char *data, size_t size, std::vector<unsigned char> &out);
+
+// Function to decode the block at data into out, which holds exactly
+// raw_size bytes, returns the bytes consumed or 0 when the block is
+// malformed or does not decode to raw_size bytes
+size_t decode_block(const unsigned char *data, size_t size, unsigned char *out, size_t raw_size);
+
+// Function to decode a block of a sequence: table holds the decode table of
+// the block before it, which a block repeating it decodes with, and holds the
+// table of this block on return
+size_t decode_block(const unsigned char *data, size_t size, unsigned char *out, size_t raw_size, DecodeTable &table);
+
+// Function to decode a block of a sequence as above, with scratch.table as
+// the carried table and no allocation once the scratch has grown
+size_t decode_block(const unsigned char *data, size_t size, unsigned char *out, size_t raw_size, DecodeScratch &scratch);
+
+// Function to decode bytes [begin, end) of the block at data into out,
+// starting from the closest sync point when the block has them
+bool decode_block_range(const unsigned char *data, size_t size, size_t begin, size_t end, unsigned char *out);
+
+// Function to decode bytes [begin, end) of a block of a sequence, table is
+// carried over as for decode_block
+bool decode_block_range(const unsigned char *data, size_t size, size_t begin, size_t end, unsigned char *out, DecodeTable &table);
+
+// Function to decode bytes [begin, end) of a block of a sequence with the memory of scratch
+bool decode_block_range(const unsigned char *data, size_t size, size_t begin, size_t end, unsigned char *out, DecodeScratch &scratch);
+
+// Function to tell whether the block at data repeats the previous table
+bool block_repeats_table(const unsigned char *data, size_t size);
+
+// Function to tell whether the block at data is a Huffman block that stores
+// its code lengths
+bool block_stores_table(const unsigned char *data, size_t size);
+
+// Function to build the decode table stored in the block at data, which only
+// needs its header and code lengths; returns false for blocks that repeat one
+bool read_block_table(const unsigned char *data, size_t size, DecodeTable &table);
+
+// Function to find the indexed block that stores the table block k of the
+// stream at data is coded with
+size_t find_table_block(const unsigned char *data, size_t size, const std::vector<BlockIndexEntry> &index, size_t k);
+
+// Function to append the block index and its trailer
+void write_block_index(std::vector<unsigned char> &out, const std::vector<BlockIndexEntry> &index);
+
+// Function to load the block index from the end of a whole stream, returns
+// false when there is no index or it does not fit the stream
+bool read_block_index(const unsigned char *data, size_t size, std::vector<BlockIndexEntry> &index);
+
+// Function to parse block_count index entries of a stream whose index starts
+// at index_start, returns false when the offsets are out of order or bounds
+bool parse_block_index(const unsigned char *entries, size_t block_count, uint64_t index_start, std::vector<BlockIndexEntry> &index);
+
+// Function to decode bytes [begin, end) of a whole stream held in memory,
+// decoding only the blocks that overlap the range
+bool decompress_range(const unsigned char *data, size_t size, uint64_t begin, uint64_t end, std::vector<unsigned char> &out);
+
+// Function to decode bytes [begin, end) of a Huffman file of blocks, reading
+// only its index and the blocks that overlap the range
+bool decompress_file_range(const std::string &huffman_filename, uint64_t begin, uint64_t end, std::vector<unsigned char> &out);
+
+// Push-style encoder: input is buffered up to one block and each full
+// block is coded and written out, so memory stays bounded by the block size.
+// finish() writes the block index after the end block. options.stats and
+// options.progress, when set, are updated after every block.
+class StreamEncoder
+{
+public:
+    explicit StreamEncoder(std::ostream &out, size_t block_size = DEFAULT_BLOCK_SIZE, const CompressionOptions &options = CompressionOptions());
+
+    // Function to add input, returns false once the output has failed
+    bool write(const unsigned char *data, size_t size);
+
+    // Function to code the last partial block and end the stream
+    bool finish();
+
+private:
+    bool flush_block();
+
+    std::ostream &out;
+    size_t block_size;
+    CompressionOptions options;
+    std::vector<unsigned char> pending; // Input of the current block
+    std::vector<unsigned char> encoded; // Scratch for the coded block
+    std::vector<BlockIndexEntry> index;
+    BlockPlan previous;                 // Plan of the last Huffman block, for table reuse
+    bool has_previous;
+    uint64_t written;                   // Bytes written to out so far
+    uint64_t consumed;                  // Input bytes coded so far, for options.progress
+    bool finished;
+};
+
+// Pull-style decoder: reads and decodes one block at a time
+class StreamDecoder
+{
+public:
+    explicit StreamDecoder(std::istream &in);
+
+    // Function to fill data with up to size decoded bytes, returns the number
+    // written; 0 means the end of the stream or an error (see failed())
+    size_t read(unsigned char *data, size_t size);
+
+    // Function to tell whether the stream was truncated or malformed
+    bool failed() const { return error; }
+
+private:
+    bool next_block();
+
+    std::istream &in;
+    std::vector<unsigned char> compressed; // Current coded block
+    std::vector<unsigned char> decoded;    // Current decoded block
+    DecodeScratch scratch;                 // Tables of the current block, kept for blocks repeating them
+    size_t position;                       // Next byte of decoded to hand out
+    bool done;
+    bool error;
+};
+
+#endif // HUFFMAN_STREAM_H
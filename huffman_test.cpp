@@ -0,0 +1,316 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_batch.h"
+#include "huffman_context.h"
+#include "huffman_parallel.h"
+#include "huffman_static.h"
+#include "huffman_corpus.h"
+#include "huffman_format.h"
+#include "huffman_pairs.h"
+#include "huffman_stream.h"
+#include "huffman_verify.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+// Size of the bench corpora the tests verify, smaller than the benchmarks' to keep the run short
+constexpr size_t TEST_CORPUS_SIZE = size_t(1) << 20;
+
+static int failures = 0;
+
+// Function to report a failed check
+static void check(bool ok, const std::string &name)
+{
+	if (ok)
+		return;
+	std::fprintf(stderr, "FAILED: %s\n", name.c_str());
+	++failures;
+}
+
+// Function to run verify_data on an input and report the decoder that disagrees
+static void check_verify(const std::string &data, const std::string &name)
+{
+	const char *failure = verify_data(reinterpret_cast<const unsigned char *>(data.data()), data.size());
+	check(failure == nullptr, name + ": " + (failure != nullptr ? failure : ""));
+}
+
+// Differential checks of every decoder against the reference tree walk
+static void test_verify()
+{
+	// Seeded random buffers over alphabets of 1 to 256 byte values, flat and skewed
+	std::mt19937 random(30);
+	for (int k = 0; k < 60; ++k)
+	{
+		std::string data(random() % (k < 40 ? 400 : 70000), '\0');
+		unsigned alphabet = 1 + random() % NUM_CHAR;
+		std::geometric_distribution<int> skew(0.05 + (random() % 90) / 100.0);
+		for (char &c : data)
+			c = static_cast<char>(k % 2 == 0 ? random() % alphabet : std::min<int>(skew(random), 255));
+		check_verify(data, "random buffer " + std::to_string(k));
+	}
+
+	// All 256 symbols, once and repeated unevenly
+	std::string all;
+	for (int i = 0; i < NUM_CHAR; ++i)
+		all.append(1 + i * i % 97, static_cast<char>(i));
+	check_verify(all, "all 256 symbols");
+
+	// A single symbol, and the empty input
+	check_verify(std::string(5000, 'x'), "single symbol");
+	check_verify(std::string(1, '\0'), "single byte");
+	check_verify(std::string(), "empty input");
+
+	check_verify(make_text(TEST_CORPUS_SIZE), "text corpus");
+	check_verify(make_binary(TEST_CORPUS_SIZE), "binary corpus");
+	check_verify(make_low_entropy(TEST_CORPUS_SIZE), "low_entropy corpus");
+	check_verify(make_random(TEST_CORPUS_SIZE), "random corpus");
+	check_verify(make_skewed(TEST_CORPUS_SIZE), "skewed corpus");
+}
+
+// Function to feed valid files of every kind, and mutations of them, to the decoders
+static void test_malformed()
+{
+	const std::string text = make_text(4096);
+	const unsigned char *data = reinterpret_cast<const unsigned char *>(text.data());
+	std::vector<std::vector<unsigned char>> seeds;
+	for (int layout = 0; layout < 4; ++layout)
+	{
+		CompressionOptions options;
+		options.sync_interval = layout == 1 ? 64 : 0;
+		options.interleaved = layout == 2;
+		options.order1 = layout == 3;
+		seeds.emplace_back();
+		encode_block(data, text.size(), options, seeds.back());
+	}
+
+	HuffmanEncoder encoder;
+	seeds.emplace_back(encoder.max_compressed_size(text.size()));
+	seeds.back().resize(encoder.compress(data, text.size(), seeds.back().data(), seeds.back().size()));
+
+	// Indexed block streams, repeating tables and with order-1 blocks, and byte pairs
+	for (int layout = 0; layout < 2; ++layout)
+	{
+		CompressionOptions options;
+		options.reuse_tables = layout == 0;
+		options.order1 = layout == 1;
+		std::ostringstream stream;
+		StreamEncoder stream_encoder(stream, 1024, options);
+		stream_encoder.write(data, text.size());
+		stream_encoder.finish();
+		const std::string blocks = stream.str();
+		seeds.emplace_back(blocks.begin(), blocks.end());
+	}
+	seeds.emplace_back();
+	encode_byte_pairs(data, text.size(), DEFAULT_MAX_CODE_LENGTH, seeds.back());
+
+	std::vector<BatchRecord> records;
+	for (size_t offset = 0; offset < text.size(); offset += 97)
+		records.push_back({data + offset, std::min<size_t>(97, text.size() - offset)});
+	seeds.emplace_back();
+	compress_batch(records, seeds.back());
+
+	// Flipped bits, overwritten bytes and truncation; the decoders must only reject them
+	std::mt19937 random(31);
+	for (int k = 0; k < 3000; ++k)
+	{
+		std::vector<unsigned char> input = seeds[random() % seeds.size()];
+		for (int edit = 1 + random() % 3; edit > 0 && !input.empty(); --edit)
+		{
+			size_t position = random() % input.size();
+			switch (random() % 3)
+			{
+			case 0:
+				input[position] ^= static_cast<unsigned char>(1u << (random() % 8));
+				break;
+			case 1:
+				input[position] = static_cast<unsigned char>(random());
+				break;
+			default:
+				input.resize(position);
+				break;
+			}
+		}
+		exercise_decoders(input.data(), input.size());
+	}
+
+	// A batch whose index claims more bytes than the records have bits
+	std::vector<unsigned char> forged = seeds.back();
+	CodeLengths lengths;
+	const size_t index_start = BATCH_HEADER_SIZE + read_code_lengths(forged.data() + BATCH_HEADER_SIZE, forged.size() - BATCH_HEADER_SIZE, lengths);
+	const uint32_t record_count = read_le32(forged.data() + 8);
+	BatchDecoder batch_decoder;
+	check(batch_decoder.open(forged.data(), forged.size()) && batch_decoder.record_count() == records.size(), "forged batch: layout");
+	for (uint32_t k = 0; k < record_count; k += 8)
+	{
+		std::vector<unsigned char> raw_size;
+		write_le32(raw_size, 0xFFFFFFF0);
+		std::copy(raw_size.begin(), raw_size.end(), forged.begin() + index_start + k * BATCH_ENTRY_SIZE + 8);
+	}
+	check(!batch_decoder.open(forged.data(), forged.size()), "forged batch: raw_size");
+
+	// A byte-pair file claiming far more bytes than its payload can spell
+	const std::string path = "huffman_test_forged.tmp", output_path = "huffman_test_forged.out";
+	const std::string pairs = make_text(1 << 16);
+	CompressionOptions options;
+	options.byte_pairs = true;
+	check(compress_data(reinterpret_cast<const unsigned char *>(pairs.data()), pairs.size(), path, options) == HuffmanStatus::OK, "byte-pair file: compress");
+	std::ifstream infile(path, std::ios::binary);
+	std::vector<unsigned char> file((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+	infile.close();
+	check(file.size() > FILE_HEADER_SIZE && (file[5] & FILE_FLAG_BYTE_PAIRS) != 0, "byte-pair file: layout");
+	if (file.size() > FILE_HEADER_SIZE)
+	{
+		std::vector<unsigned char> size_field;
+		write_le64(size_field, uint64_t(1) << 40);
+		std::copy(size_field.begin(), size_field.end(), file.begin() + 8);
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char *>(file.data()), static_cast<std::streamsize>(file.size()));
+		std::remove(output_path.c_str());
+		check(decompress_file(path, output_path) == HuffmanStatus::HUFFMAN_READ_FAILED && !std::ifstream(output_path).is_open(),
+			  "byte-pair file: forged original_size");
+	}
+
+	// Files failing their checksum, single table and blocked, must leave no pre-sized output behind
+	for (size_t block_size : {size_t(0), size_t(1) << 14})
+	{
+		CompressionOptions layout;
+		layout.block_size = block_size;
+		check(compress_data(reinterpret_cast<const unsigned char *>(pairs.data()), pairs.size(), path, layout) == HuffmanStatus::OK, "checksum file: compress");
+		std::fstream checksum_file(path, std::ios::binary | std::ios::in | std::ios::out);
+		checksum_file.seekp(16);
+		checksum_file.put('\xA5').put('\x5A');
+		checksum_file.close();
+		check(decompress_file(path, output_path) == HuffmanStatus::HUFFMAN_READ_FAILED && !std::ifstream(output_path).is_open(),
+			  "checksum file: output removed, block size " + std::to_string(block_size));
+	}
+	std::remove(path.c_str());
+	std::remove(output_path.c_str());
+}
+
+// Ranges starting in a stored, RLE or order-1 block before a block that
+// repeats an earlier table must still find that table
+static void test_range_after_untabled_block()
+{
+	const size_t block_size = 4096;
+	std::string text = make_text(block_size);
+	std::string input = text + std::string(block_size, 'z') + text;
+
+	CompressionOptions options;
+	options.reuse_tables = true;
+	std::ostringstream stream;
+	StreamEncoder encoder(stream, block_size, options);
+	encoder.write(reinterpret_cast<const unsigned char *>(input.data()), input.size());
+	encoder.finish();
+	const std::string compressed = stream.str();
+	const unsigned char *data = reinterpret_cast<const unsigned char *>(compressed.data());
+
+	// Huffman block storing its table, a block without one, a block repeating the first table
+	std::vector<BlockIndexEntry> index;
+	check(read_block_index(data, compressed.size(), index) && index.size() == 3, "range layout: index");
+	if (index.size() != 3)
+		return;
+	auto at = [&](size_t k)
+	{ return std::make_pair(data + index[k].offset, compressed.size() - static_cast<size_t>(index[k].offset)); };
+	check(block_stores_table(at(0).first, at(0).second) && !block_stores_table(at(1).first, at(1).second) &&
+			  !block_repeats_table(at(1).first, at(1).second) && block_repeats_table(at(2).first, at(2).second),
+		  "range layout: Huffman, untabled, repeat");
+
+	const std::string path = "huffman_test_range.tmp";
+	{
+		std::ofstream file(path, std::ios::binary);
+		file.write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+	}
+	for (uint64_t begin : {uint64_t(0), uint64_t(100), uint64_t(5000), uint64_t(block_size * 2), uint64_t(9000)})
+	{
+		const uint64_t end = std::min<uint64_t>(input.size(), begin + 4000);
+		const std::string expected = input.substr(static_cast<size_t>(begin), static_cast<size_t>(end - begin));
+		std::vector<unsigned char> out;
+		check(decompress_range(data, compressed.size(), begin, end, out) && std::string(out.begin(), out.end()) == expected,
+			  "decompress_range from " + std::to_string(begin));
+		check(decompress_file_range(path, begin, end, out) && std::string(out.begin(), out.end()) == expected,
+			  "decompress_file_range from " + std::to_string(begin));
+	}
+	std::remove(path.c_str());
+}
+
+// One parallel decoder reused over streams whose blocks repeat tables
+static void test_parallel_decoder_reuse()
+{
+	CompressionOptions options;
+	options.reuse_tables = true;
+	ParallelBlockDecoder decoder(3);
+	for (int stream = 0; stream < 3; ++stream)
+	{
+		std::string input = make_text((stream + 1) << 18) + make_binary(size_t(1) << 17);
+		std::ostringstream compressed;
+		StreamEncoder encoder(compressed, 16384, options);
+		encoder.write(reinterpret_cast<const unsigned char *>(input.data()), input.size());
+		encoder.finish();
+		const std::string blocks = compressed.str();
+		const unsigned char *data = reinterpret_cast<const unsigned char *>(blocks.data());
+
+		std::vector<BlockIndexEntry> index;
+		std::string out(input.size(), '\0');
+		for (int call = 0; call < 2; ++call)
+			check(read_block_index(data, blocks.size(), index) &&
+					  decoder.decode(data, blocks.size(), index, reinterpret_cast<unsigned char *>(&out[0])) && out == input,
+				  "parallel decoder stream " + std::to_string(stream) + " call " + std::to_string(call));
+	}
+}
+
+// Frequencies of every byte value, roughly halving so the 12-bit limit cuts the longest codes, with a few unused
+static constexpr std::array<unsigned int, NUM_CHAR> static_frequency()
+{
+	std::array<unsigned int, NUM_CHAR> frequency{};
+	for (int i = 0; i < NUM_CHAR; ++i)
+		frequency[i] = i % 17 == 5 ? 0 : (1u << (24 - i % 25)) + static_cast<unsigned int>(i);
+	return frequency;
+}
+
+// A compile-time code must write and read the same bitstreams as the runtime canonical code
+static void test_static_code()
+{
+	constexpr std::array<unsigned int, NUM_CHAR> frequency = static_frequency();
+	static constexpr StaticCode<NUM_CHAR, 12> code = static_code_from_frequency<NUM_CHAR, 12>(frequency);
+	static_assert(code.valid, "the frequencies have a code of at most 12 bits");
+
+	CodeLengths lengths;
+	CodeTable codes{};
+	build_code_lengths(frequency, 12, lengths);
+	check(std::equal(lengths.begin(), lengths.end(), code.lengths.begin()) && build_canonical_codes(lengths, codes), "static code: lengths");
+
+	std::mt19937 random(20);
+	std::vector<unsigned char> symbols;
+	while (symbols.size() < 20000)
+	{
+		unsigned char symbol = static_cast<unsigned char>(random() % NUM_CHAR);
+		if (frequency[symbol] != 0)
+			symbols.push_back(symbol);
+	}
+
+	std::vector<unsigned char> expected;
+	encode_data(symbols.data(), symbols.size(), codes, expected);
+	std::vector<unsigned char> packed(symbols.size() * 2);
+	packed.resize(code.encode(symbols.data(), symbols.size(), packed.data(), packed.size()));
+	check(packed == expected, "static code: encode");
+
+	std::vector<unsigned char> decoded(symbols.size());
+	check(code.decode(packed.data(), packed.size(), decoded.data(), decoded.size()) == symbols.size() && decoded == symbols, "static code: decode");
+}
+
+int main()
+{
+	test_verify();
+	test_malformed();
+	test_range_after_untabled_block();
+	test_parallel_decoder_reuse();
+	test_static_code();
+	if (failures != 0)
+		return 1;
+	std::printf("All tests passed.\n");
+	return 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_verify.h"
+#include "huffman_batch.h"
+#include "huffman_context.h"
+#include "huffman_embedded.h"
+#include "huffman_pairs.h"
+#include "huffman_parallel.h"
+#include "huffman_stream.h"
+
+#include <cstring>
+#include <sstream>
+
+// Function to compare decoded bytes with the original ones
+static bool same_bytes(const unsigned char *expected, size_t size, const unsigned char *decoded, size_t decoded_size)
+{
+	return decoded_size == size && (size == 0 || std::memcmp(expected, decoded, size) == 0);
+}
+
+// Function to check the fast paths against the reference encoder and decoder
+const char *verify_codes(const unsigned char *data, size_t size, const CodeTable &codes)
+{
+	// Reference encoding, one code at a time
+	std::vector<unsigned char> reference;
+	BitWriter writer(reference);
+	for (size_t i = 0; i < size; ++i)
+		writer.put(codes[data[i]].bits, codes[data[i]].length);
+	writer.flush();
+	const uint64_t bit_count = writer.bit_count();
+
+	std::vector<unsigned char> packed;
+	if (encode_data(data, size, codes, packed) != bit_count || packed != reference)
+		return "encode_data";
+
+	std::shared_ptr<Node> root = std::make_shared<Node>('+', 0);
+	build_tree_from_codes(codes, root);
+	std::string expected = decode_data(reference.data(), reference.size(), root, static_cast<long long>(bit_count));
+	if (!same_bytes(data, size, reinterpret_cast<const unsigned char *>(expected.data()), expected.size()))
+		return "decode_data";
+
+	std::vector<unsigned char> decoded(size);
+	DecodeTree tree;
+	if (!build_decode_tree(codes, tree))
+		return "build_decode_tree";
+	if (decode_symbols_tree(reference.data(), reference.size(), tree, decoded.data(), size) != size || !same_bytes(data, size, decoded.data(), size))
+		return "decode_symbols_tree";
+
+	int longest = 0;
+	for (const Codeword &code : codes)
+		longest = std::max<int>(longest, code.length);
+	if (longest > MAX_TABLE_CODE_LENGTH)
+		return nullptr;
+
+	DecodeTable table;
+	if (!build_decode_table(codes, table))
+		return "build_decode_table";
+	if (decode_data_table(reference.data(), reference.size(), table, static_cast<long long>(bit_count)) != expected)
+		return "decode_data_table";
+
+	// Sync points and block ranges start decoding inside a byte
+	for (int skip_bits = 0; skip_bits < 8; ++skip_bits)
+	{
+		std::vector<unsigned char> shifted;
+		BitWriter shifted_writer(shifted);
+		shifted_writer.put(0, skip_bits);
+		for (size_t i = 0; i < size; ++i)
+			shifted_writer.put(codes[data[i]].bits, codes[data[i]].length);
+		shifted_writer.flush();
+
+		std::fill(decoded.begin(), decoded.end(), 0);
+		if (decode_symbols(shifted.data(), shifted.size(), table, decoded.data(), size, skip_bits) != size || !same_bytes(data, size, decoded.data(), size))
+			return "decode_symbols";
+	}
+
+	std::vector<unsigned char> interleaved;
+	encode_data_interleaved(data, size, codes, interleaved);
+	std::fill(decoded.begin(), decoded.end(), 0);
+	if (decode_symbols_interleaved(interleaved.data(), interleaved.size(), table, decoded.data(), size) != size || !same_bytes(data, size, decoded.data(), size))
+		return "decode_symbols_interleaved";
+	return nullptr;
+}
+
+// Function to verify the data under the code built for it with max_code_length
+static const char *verify_limit(const unsigned char *data, size_t size, const std::array<unsigned int, NUM_CHAR> &frequency, int max_code_length)
+{
+	CodeLengths lengths;
+	CodeTable codes{};
+	build_code_lengths(frequency, max_code_length, lengths);
+	if (!build_canonical_codes(lengths, codes))
+		return "build_canonical_codes";
+	return verify_codes(data, size, codes);
+}
+
+// Bytes of an in-memory file for EmbeddedDecoder, and what it decoded
+struct EmbeddedBuffer
+{
+	const unsigned char *data;
+	size_t size;
+	size_t position;
+	std::vector<unsigned char> decoded;
+};
+
+static int embedded_read(void *context)
+{
+	EmbeddedBuffer &buffer = *static_cast<EmbeddedBuffer *>(context);
+	return buffer.position < buffer.size ? buffer.data[buffer.position++] : -1;
+}
+
+static bool embedded_write(void *context, const uint8_t *data, size_t size)
+{
+	EmbeddedBuffer &buffer = *static_cast<EmbeddedBuffer *>(context);
+	if (buffer.decoded.size() + size > VERIFY_MAX_OUTPUT)
+		return false;
+	buffer.decoded.insert(buffer.decoded.end(), data, data + size);
+	return true;
+}
+
+// Function to check the containers round trip through their decoders
+static const char *verify_containers(const unsigned char *data, size_t size)
+{
+	// Blocks in every layout of encode_block
+	for (int layout = 0; layout < 4; ++layout)
+	{
+		CompressionOptions options;
+		options.sync_interval = layout == 1 ? 64 : 0;
+		options.interleaved = layout == 2;
+		options.order1 = layout == 3;
+		for (size_t offset = 0; offset < size || offset == 0; offset += MAX_BLOCK_SIZE)
+		{
+			size_t block_size = std::min(size - offset, MAX_BLOCK_SIZE);
+			std::vector<unsigned char> block, decoded;
+			encode_block(data + offset, block_size, options, block);
+			if (decode_block(block.data(), block.size(), decoded) != block.size() || !same_bytes(data + offset, block_size, decoded.data(), decoded.size()))
+				return "decode_block";
+			if (size == 0)
+				break;
+		}
+	}
+
+	// Byte pairs, at the default and the table limit; the pair entries decode two symbols at once
+	for (int max_code_length : {DEFAULT_MAX_CODE_LENGTH, MAX_TABLE_CODE_LENGTH})
+	{
+		if (size == 0)
+			break;
+		std::vector<unsigned char> pairs, decoded(size);
+		encode_byte_pairs(data, size, max_code_length, pairs);
+		if (!decode_byte_pairs(pairs.data(), pairs.size(), decoded.data(), size) || !same_bytes(data, size, decoded.data(), size))
+			return "decode_byte_pairs";
+	}
+
+	// Messages, through the library decoder and the embedded one (at its 15-bit limit)
+	CompressionOptions options;
+	options.max_code_length = 15;
+	HuffmanEncoder encoder(options);
+	std::vector<unsigned char> message(encoder.max_compressed_size(size));
+	size_t message_size = encoder.compress(data, size, message.data(), message.size());
+	if (message_size == 0)
+		return "HuffmanEncoder::compress";
+
+	std::vector<unsigned char> decoded(size);
+	size_t decoded_size;
+	HuffmanDecoder decoder;
+	if (!decoder.decompress(message.data(), message_size, decoded.data(), decoded.size(), decoded_size) || !same_bytes(data, size, decoded.data(), decoded_size))
+		return "HuffmanDecoder::decompress";
+
+	if (size <= VERIFY_MAX_OUTPUT)
+	{
+		EmbeddedBuffer buffer{message.data(), message_size, 0, {}};
+		EmbeddedDecoder<15> embedded(embedded_read, embedded_write, &buffer);
+		if (embedded.decode() != EmbeddedStatus::OK || buffer.position != message_size || !same_bytes(data, size, buffer.decoded.data(), buffer.decoded.size()))
+			return "EmbeddedDecoder::decode";
+	}
+
+	// Batches of uneven records, empty ones included
+	std::vector<BatchRecord> records;
+	for (size_t offset = 0, length = 0; offset < size; offset += length, length = (length * 7 + 5) % 301)
+		records.push_back({data + offset, std::min(length, size - offset)});
+	std::vector<unsigned char> batch;
+	BatchDecoder batch_decoder;
+	std::vector<std::vector<unsigned char>> batch_records;
+	if (!compress_batch(records, batch) || !batch_decoder.open(batch.data(), batch.size()) || !batch_decoder.decode_all(batch_records) ||
+		batch_records.size() != records.size())
+		return "BatchDecoder::decode_all";
+	for (size_t k = 0; k < records.size(); ++k)
+		if (!same_bytes(records[k].data, records[k].size, batch_records[k].data(), batch_records[k].size()))
+			return "BatchDecoder::decode_all";
+	return nullptr;
+}
+
+// Function to verify the decoders on the data under its own and adversarial codes
+const char *verify_data(const unsigned char *data, size_t size)
+{
+	std::array<unsigned int, NUM_CHAR> frequency;
+	init_frequency(frequency);
+	fill_frequency(data, size, frequency);
+
+	// The shortest limit that still fits the distinct bytes, the primary table bits, the default and the table limit
+	int distinct = static_cast<int>(std::count_if(frequency.begin(), frequency.end(), [](unsigned int count)
+												  { return count != 0; }));
+	int shortest = 1;
+	while ((1 << shortest) < distinct)
+		++shortest;
+	for (int max_code_length : {shortest, DECODE_TABLE_BITS, DEFAULT_MAX_CODE_LENGTH, MAX_TABLE_CODE_LENGTH})
+	{
+		if (max_code_length < shortest)
+			continue;
+		if (const char *failure = verify_limit(data, size, frequency, max_code_length))
+			return failure;
+	}
+
+	// Every byte value, with weights halving from one to the next so the limit cuts the longest codes
+	std::array<unsigned int, NUM_CHAR> skewed;
+	for (int i = 0; i < NUM_CHAR; ++i)
+		skewed[i] = 1u << (30 - std::min(i, 30));
+	if (const char *failure = verify_limit(data, size, skewed, MAX_TABLE_CODE_LENGTH))
+		return failure;
+
+	// A single symbol, coded with one bit
+	if (size > 0)
+	{
+		std::vector<unsigned char> run(std::min<size_t>(size, 4096), data[0]);
+		std::array<unsigned int, NUM_CHAR> single;
+		init_frequency(single);
+		fill_frequency(run.data(), run.size(), single);
+		if (const char *failure = verify_limit(run.data(), run.size(), single, DEFAULT_MAX_CODE_LENGTH))
+			return failure;
+		if (const char *failure = verify_containers(run.data(), run.size()))
+			return failure;
+	}
+
+	return verify_containers(data, size);
+}
+
+// Function to tell whether every block header StreamDecoder would read
+// from data claims at most VERIFY_MAX_OUTPUT bytes and a payload within data
+static bool stream_within_bounds(const unsigned char *data, size_t size)
+{
+	uint32_t raw_size, payload_size;
+	for (size_t position = 0; read_block_header(data + position, size - position, raw_size, payload_size) && raw_size != 0;)
+	{
+		if (raw_size > VERIFY_MAX_OUTPUT || payload_size > size - position - BLOCK_HEADER_SIZE)
+			return false;
+		position += BLOCK_HEADER_SIZE + payload_size;
+	}
+	return true;
+}
+
+// Function to feed the bytes to every in-memory decoder
+void exercise_decoders(const unsigned char *data, size_t size)
+{
+	std::vector<unsigned char> out;
+
+	// Code lengths followed by packed data, through every symbol decoder
+	CodeLengths lengths;
+	CodeTable codes{};
+	size_t consumed = read_code_lengths(data, size, lengths);
+	if (consumed != 0 && build_canonical_codes(lengths, codes))
+	{
+		const unsigned char *packed = data + consumed;
+		const size_t packed_size = size - consumed;
+		const size_t count = std::min(packed_size * 8, VERIFY_MAX_OUTPUT);
+		out.resize(count);
+
+		std::shared_ptr<Node> root = std::make_shared<Node>('+', 0);
+		build_tree_from_codes(codes, root);
+		decode_data(packed, packed_size, root, static_cast<long long>(packed_size) * 8);
+
+		DecodeTree tree;
+		if (build_decode_tree(codes, tree))
+			decode_symbols_tree(packed, packed_size, tree, out.data(), count);
+
+		DecodeTable table;
+		if (build_decode_table(codes, table))
+		{
+			decode_data_table(packed, packed_size, table, static_cast<long long>(packed_size) * 8);
+			decode_symbols(packed, packed_size, table, out.data(), count, static_cast<int>(size % 8));
+			decode_symbols_interleaved(packed, packed_size, table, out.data(), count);
+		}
+	}
+
+	// A block, when the size it claims is within bounds
+	uint32_t raw_size, payload_size;
+	if (read_block_header(data, size, raw_size, payload_size) && raw_size <= VERIFY_MAX_OUTPUT)
+		decode_block(data, size, out);
+
+	// A block stream read through StreamDecoder, when its blocks are within bounds
+	if (stream_within_bounds(data, size))
+	{
+		std::istringstream in(std::string(reinterpret_cast<const char *>(data), size));
+		StreamDecoder stream(in);
+		out.resize(4096);
+		while (stream.read(out.data(), out.size()) != 0)
+			;
+	}
+
+	// The same bytes as index entries, and as an indexed stream decoded whole, in ranges and on workers
+	std::vector<BlockIndexEntry> index;
+	parse_block_index(data, size / BLOCK_INDEX_ENTRY_SIZE, size, index);
+	if (read_block_index(data, size, index))
+	{
+		uint64_t total = 0;
+		for (const BlockIndexEntry &block : index)
+			total += block.raw_size;
+		if (total <= VERIFY_MAX_OUTPUT)
+		{
+			decompress_range(data, size, 0, total, out);
+			decompress_range(data, size, total / 3, total - total / 5, out);
+
+			// Workers kept across inputs, as a long-running decoder would
+			static ParallelBlockDecoder parallel_decoder(2);
+			out.resize(static_cast<size_t>(total));
+			parallel_decoder.decode(data, size, index, out.data());
+		}
+	}
+
+	// Byte-pair data, without the container header in front
+	out.resize(static_cast<size_t>(std::min<uint64_t>(uint64_t(size) * 16, VERIFY_MAX_OUTPUT)));
+	decode_byte_pairs(data, size, out.data(), out.size());
+
+	// A message, and the same bytes as a file for the embedded decoder
+	out.resize(VERIFY_MAX_OUTPUT);
+	size_t out_size;
+	HuffmanDecoder decoder;
+	decoder.decompress(data, size, out.data(), out.size(), out_size);
+
+	EmbeddedBuffer buffer{data, size, 0, {}};
+	EmbeddedDecoder<15> embedded(embedded_read, embedded_write, &buffer);
+	embedded.decode();
+
+	// A serialized dictionary, then a batch using it when it loads
+	HuffmanDictionary dictionary;
+	BatchDecoder batch_decoder;
+	if (read_dictionary(data, size, dictionary))
+		batch_decoder.add_dictionary(&dictionary);
+	if (batch_decoder.open(data, size))
+	{
+		for (size_t k = 0; k < batch_decoder.record_count(); ++k)
+			batch_decoder.decode(k, out.data(), out.size(), out_size);
+
+		// open() bounds every record by its bits, so decode_all allocates at most 8 bytes per input byte
+		std::vector<std::vector<unsigned char>> records;
+		batch_decoder.decode_all(records, 2);
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#ifndef HUFFMAN_VERIFY_H
+#define HUFFMAN_VERIFY_H
+
+#include "huffman_compression.h"
+
+// Bytes of output the decoders may produce per input handed to
+// exercise_decoders, so sizes claimed by malformed headers stay bounded
+constexpr size_t VERIFY_MAX_OUTPUT = size_t(1) << 20;
+
+// Differential checks of the fast encoders and decoders against the
+// reference ones: codes are written one at a time with BitWriter and read
+// back by walking the Huffman tree (decode_data), and every optimized path
+// must give the same bits and bytes. Each check returns the name of the
+// first function that disagrees, or nullptr when all of them agree.
+
+// Function to check encode_data against BitWriter and decode_data_table,
+// decode_symbols (from every bit offset), decode_symbols_tree and the
+// interleaved streams against decode_data, on data coded with codes. Every
+// byte of data must have a code; codes longer than MAX_TABLE_CODE_LENGTH
+// only go through the tree decoders.
+const char *verify_codes(const unsigned char *data, size_t size, const CodeTable &codes);
+
+// Function to run verify_codes on data under the code built for it with
+// every limit the table decoders special-case, and under adversarial codes:
+// all 256 byte values with codes of up to MAX_TABLE_CODE_LENGTH bits, and a
+// single symbol (a run of the first byte). Then checks the containers round
+// trip through their decoders: blocks in every layout, byte pairs, messages
+// (also through EmbeddedDecoder) and batches.
+const char *verify_data(const unsigned char *data, size_t size);
+
+// Function to hand arbitrary bytes to every in-memory decoder as a code
+// length header and packed data, a block, a block stream (StreamDecoder), an
+// indexed one (whole, in ranges and on ParallelBlockDecoder workers), byte
+// pairs, a message, an embedded file, a dictionary and a batch. It must not
+// crash, hang or read out of bounds whatever the input, so it is meant to be
+// called from a fuzzer, e.g. from LLVMFuzzerTestOneInput built with
+// -fsanitize=fuzzer,address. The workers are shared, so calls must not run
+// at the same time.
+void exercise_decoders(const unsigned char *data, size_t size);
+
+#endif // HUFFMAN_VERIFY_H
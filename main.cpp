@@ -0,0 +1,146 @@
+/*
+ * ArduinoHuffman
+ * Authors: Rafael Perez
+ */
+
+#include "huffman_compression.h"
+#include "huffman_mmap.h"
+#include "huffman_verify.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Function to print the command line usage
+static void print_usage(const char *program)
+{
+	std::cerr << "Usage: " << program << " compress <input> <output> [options]\n"
+			  << "       " << program << " decompress <input> <output> [--stats]\n"
+			  << "       " << program << " verify <input>\n"
+			  << "Options:\n"
+			  << "  --block-size <bytes>   code independent blocks of this size\n"
+			  << "  --threads <count>      worker threads in block mode\n"
+			  << "  --sync <symbols>       record a sync point every this many symbols\n"
+			  << "  --max-length <bits>    longest code, 0 for no limit\n"
+			  << "  --interleaved          split each block over interleaved bitstreams\n"
+			  << "  --reuse-tables         let blocks repeat the previous code table\n"
+			  << "  --order1               try order-1 context tables per block\n"
+			  << "  --byte-pairs           try byte-pair symbols (single table files)\n"
+			  << "  --pipeline             overlap reading, coding and writing (block mode)\n"
+			  << "  --sample <step>        estimate byte counts from 1 of every step 4 KiB runs\n"
+			  << "  --explicit             store the explicit dictionary instead of code lengths\n"
+			  << "  --stats                print sizes, code statistics and stage times\n";
+}
+
+// Function to parse the options after the file names, returns false on an unknown one
+static bool parse_options(int argc, char **argv, CompressionOptions &options, bool &show_stats)
+{
+	for (int i = 4; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		if (std::strcmp(arg, "--block-size") == 0 && has_value)
+			options.block_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (std::strcmp(arg, "--threads") == 0 && has_value)
+			options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+		else if (std::strcmp(arg, "--sync") == 0 && has_value)
+			options.sync_interval = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		else if (std::strcmp(arg, "--max-length") == 0 && has_value)
+			options.max_code_length = std::atoi(argv[++i]);
+		else if (std::strcmp(arg, "--interleaved") == 0)
+			options.interleaved = true;
+		else if (std::strcmp(arg, "--reuse-tables") == 0)
+			options.reuse_tables = true;
+		else if (std::strcmp(arg, "--order1") == 0)
+			options.order1 = true;
+		else if (std::strcmp(arg, "--byte-pairs") == 0)
+			options.byte_pairs = true;
+		else if (std::strcmp(arg, "--sample") == 0 && has_value)
+			options.sample_step = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+		else if (std::strcmp(arg, "--pipeline") == 0)
+			options.pipeline = true;
+		else if (std::strcmp(arg, "--explicit") == 0)
+			options.canonical = false;
+		else if (std::strcmp(arg, "--stats") == 0)
+			show_stats = true;
+		else
+			return false;
+	}
+	return true;
+}
+
+// Function to print the statistics of one call
+static void print_stats(const CompressionStats &stats)
+{
+	std::cout << "Bytes in:          " << stats.bytes_in << "\n"
+			  << "Bytes out:         " << stats.bytes_out << "\n"
+			  << "Symbols:           " << stats.symbols << "\n"
+			  << "Distinct symbols:  " << stats.distinct_symbols << "\n"
+			  << "Max code length:   " << stats.max_code_length << "\n"
+			  << "Blocks:            " << stats.blocks << "\n"
+			  << "Histogram:         " << stats.histogram_ns / 1000 << " us\n"
+			  << "Tree:              " << stats.tree_ns / 1000 << " us\n"
+			  << "Coding:            " << stats.code_ns / 1000 << " us\n"
+			  << "I/O:               " << stats.io_ns / 1000 << " us\n";
+}
+
+int main(int argc, char **argv)
+{
+	// Check the fast encoders and decoders against the reference ones on a file
+	if (argc == 3 && std::strcmp(argv[1], "verify") == 0)
+	{
+		MappedInput input;
+		if (!input.open(argv[2]))
+		{
+			std::cerr << status_message(HuffmanStatus::INPUT_OPEN_FAILED) << "\n";
+			return 1;
+		}
+		if (const char *failure = verify_data(input.data(), input.size()))
+		{
+			std::cerr << "Verification failed: " << failure << "\n";
+			return 1;
+		}
+		std::cout << "All decoders agree.\n";
+		return 0;
+	}
+
+	CompressionOptions options;
+	bool show_stats = false;
+	if (argc < 4 || !parse_options(argc, argv, options, show_stats))
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	CompressionStats stats;
+	if (show_stats)
+		options.stats = &stats;
+
+	HuffmanStatus status;
+	if (std::strcmp(argv[1], "compress") == 0)
+	{
+		status = compress_path(argv[2], argv[3], options);
+		if (status == HuffmanStatus::OK)
+			std::cout << "File compressed successfully.\n";
+	}
+	else if (std::strcmp(argv[1], "decompress") == 0)
+	{
+		status = decompress_file(argv[2], argv[3], options);
+		if (status == HuffmanStatus::OK)
+			std::cout << "File decompressed successfully.\n";
+	}
+	else
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if (status != HuffmanStatus::OK)
+	{
+		std::cerr << status_message(status) << "\n";
+		return 1;
+	}
+	if (show_stats)
+		print_stats(stats);
+	return 0;
+}